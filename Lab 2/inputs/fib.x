@@ -0,0 +1,17 @@
+E3A0001F
+EB000002
+E3A05F41
+E5852000
+EA000009
+E3A01001
+E3A02000
+E3500000
+0A000003
+E0811002
+E0412002
+E2500001
+5AFFFFFB
+E1A00002
+E1A0F00E
+E5956000
+EF00000A
@@ -0,0 +1,194 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  libarmsim entry points. Every call selects the handle as the
+  thread's current sim_ctx for its duration and puts the previous one
+  back, so the library can share a thread with other users of SIM.
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "shell.h"
+#include "armsim.h"
+
+int  map_memory (char *error, size_t len);
+int  set_region (const char *name, const char *start, const char *size);
+
+#define ENTER(sim) sim_ctx *prev_ = SIM; SIM = (sim)
+#define LEAVE()    SIM = prev_
+
+int armsim_set_region (const char *name, uint32_t start, uint32_t size) {
+
+  char s[16], z[16];
+
+  sprintf(s, "%u", start);
+  sprintf(z, "%u", size);
+  return set_region(name, s, z);
+}
+
+armsim_t *armsim_create (void) {
+
+  sim_ctx *ctx = sim_ctx_create();
+  char error[128];
+  int mapped;
+
+  if (ctx == NULL)
+    return NULL;
+  TRACE_LEVEL = TRACE_NONE;
+  {
+    ENTER(ctx);
+    mapped = map_memory(error, sizeof(error));
+    LEAVE();
+  }
+  if (mapped < 0) {
+    sim_ctx_destroy(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+void armsim_destroy (armsim_t *sim) {
+
+  if (sim != NULL)
+    sim_ctx_destroy(sim);
+}
+
+int armsim_load (armsim_t *sim, const char *filename) {
+
+  int words;
+  ENTER(sim);
+
+  words = read_program((char *)filename, NULL, 0);
+  if (words >= 0) {
+    NEXT_STATE = CURRENT_STATE;
+    RUN_BIT = 1;
+  }
+  LEAVE();
+  return words;
+}
+
+int armsim_load_image (armsim_t *sim, uint32_t addr, const uint8_t *image,
+                       uint32_t len) {
+
+  uint32_t avail, k;
+  int words = (len + 3) / 4;
+  uint8_t *dst = armsim_read_mem(sim, addr, &avail);
+
+  if ((addr & 3) || dst == NULL || avail < 4u * words)
+    return -1;
+  {
+    ENTER(sim);
+    /* straight into the region's buffer (text, with SPLIT_TEXT), as
+       little-endian words */
+    for (k = 0; k < len; k++)
+      dst[(k & ~3u) + 3 - (k & 3)] = image[k];
+    predecode_flush();
+    CURRENT_STATE.PC = addr;
+    NEXT_STATE = CURRENT_STATE;
+    RUN_BIT = 1;
+    LEAVE();
+  }
+  return words;
+}
+
+int armsim_step_n (armsim_t *sim, int n) {
+
+  int retired;
+  ENTER(sim);
+
+  retired = step_n(n);
+  LEAVE();
+  return retired;
+}
+
+long long armsim_run (armsim_t *sim) {
+
+  long long total = 0;
+  ENTER(sim);
+
+  while (RUN_BIT)
+    total += step_n(INT_MAX);
+  LEAVE();
+  return total;
+}
+
+int armsim_halted (armsim_t *sim) {
+
+  return !sim->run_bit;
+}
+
+long long armsim_instruction_count (armsim_t *sim) {
+
+  return sim->instruction_count;
+}
+
+uint32_t armsim_read_reg (armsim_t *sim, int r) {
+
+  if (r == ARMSIM_CPSR)
+    return sim->current.CPSR;
+  return (r >= 0 && r < ARM_REGS) ? sim->current.REGS[r] : 0;
+}
+
+void armsim_write_reg (armsim_t *sim, int r, uint32_t value) {
+
+  if (r == ARMSIM_CPSR) {
+    sim->current.CPSR = sim->next.CPSR = value;
+  } else if (r >= 0 && r < ARM_REGS) {
+    sim->current.REGS[r] = sim->next.REGS[r] = value;
+  }
+}
+
+uint8_t *armsim_read_mem (armsim_t *sim, uint32_t addr, uint32_t *len) {
+
+  int i;
+
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    mem_region_t *r = &sim->regions[i];
+    if (addr - r->start < r->size) {
+      if (len != NULL)
+        *len = r->size - (addr - r->start);
+      return r->mem + (addr - r->start);
+    }
+  }
+  if (len != NULL)
+    *len = 0;
+  return NULL;
+}
+
+uint32_t armsim_read_word (armsim_t *sim, uint32_t addr) {
+
+  uint32_t value;
+  ENTER(sim);
+
+  value = mem_peek_32(addr);
+  LEAVE();
+  return value;
+}
+
+void armsim_write_word (armsim_t *sim, uint32_t addr, uint32_t value) {
+
+  ENTER(sim);
+  mem_write_32(addr, value);
+  LEAVE();
+}
+
+void armsim_set_engine (int engine) {
+
+  ENGINE = engine;
+}
+
+int armsim_engine (armsim_t *sim) {
+
+  if (ENGINE == ENGINE_JIT && sim->jit_failed)
+    return ARMSIM_ENGINE_THREADED;
+  return ENGINE;
+}
@@ -0,0 +1,104 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _ARMSIM_H_
+#define _ARMSIM_H_
+
+/*
+  libarmsim: the simulator as a library (make libarmsim.so).
+
+  Each armsim_t is an independent simulated program with its own
+  registers and memory; different handles may be used from different
+  threads at once. Engine selection is process-wide. The library never
+  traces and never prints.
+*/
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ARMSIM_API __attribute__((visibility("default")))
+
+#define ARMSIM_ENGINE_INTERP   0
+#define ARMSIM_ENGINE_THREADED 1
+#define ARMSIM_ENGINE_JIT      2
+
+#define ARMSIM_CPSR 16 /* armsim_read_reg index for the CPSR */
+
+typedef struct sim_ctx armsim_t;
+
+/* Move or resize a region ("text", "data", "stack", "kdata", "ktext")
+   for handles created after this call. start and size must be 4 KB
+   aligned; returns -1 on a bad name or alignment. Giving data the same
+   start and size as text makes separate instruction and data memories
+   at those addresses, as in the Lab 4 RTL: fetch, armsim_load_image
+   and armsim_read_mem see text, loads, stores and the word calls see
+   data. */
+ARMSIM_API int armsim_set_region (const char *name, uint32_t start,
+                                  uint32_t size);
+
+/* New program with the default memory map, all memory zero. NULL if
+   the layout set with armsim_set_region overlaps or memory can't be
+   mapped. */
+ARMSIM_API armsim_t *armsim_create (void);
+ARMSIM_API void      armsim_destroy (armsim_t *sim);
+
+/* Load a .x file at the start of text, set PC there and un-halt.
+   Returns the number of words read, -1 if the file can't be read. */
+ARMSIM_API int armsim_load (armsim_t *sim, const char *filename);
+
+/* Store len bytes of a big-endian image (the byte order of the Lab 4
+   memories) from addr, set PC to addr and un-halt. Returns the number
+   of words stored, -1 if the range is not mapped. Bypasses the
+   commit trace and data cache model. */
+ARMSIM_API int armsim_load_image (armsim_t *sim, uint32_t addr,
+                                  const uint8_t *image, uint32_t len);
+
+/* Execute up to n instructions; returns how many retired, which is
+   less than n only if the program halted. */
+ARMSIM_API int armsim_step_n (armsim_t *sim, int n);
+
+/* Run until halt; returns instructions retired by this call. */
+ARMSIM_API long long armsim_run (armsim_t *sim);
+
+ARMSIM_API int       armsim_halted (armsim_t *sim);
+ARMSIM_API long long armsim_instruction_count (armsim_t *sim);
+
+/* r = 0..15 or ARMSIM_CPSR */
+ARMSIM_API uint32_t armsim_read_reg (armsim_t *sim, int r);
+ARMSIM_API void     armsim_write_reg (armsim_t *sim, int r, uint32_t value);
+
+/*
+  Zero-copy access to guest memory: a pointer to the host byte that
+  holds guest address addr, and in *len the bytes that follow it
+  contiguously (to the end of its region). NULL if no region covers
+  addr. Words are stored little-endian. The pointer stays valid until
+  armsim_destroy; writes through it bypass predecode invalidation, so
+  use armsim_write_word to patch code.
+*/
+ARMSIM_API uint8_t *armsim_read_mem (armsim_t *sim, uint32_t addr,
+                                     uint32_t *len);
+ARMSIM_API uint32_t armsim_read_word (armsim_t *sim, uint32_t addr);
+ARMSIM_API void     armsim_write_word (armsim_t *sim, uint32_t addr,
+                                       uint32_t value);
+
+ARMSIM_API void armsim_set_engine (int engine);
+
+/* The engine this handle actually runs on: the one set above, except
+   ARMSIM_ENGINE_THREADED once the JIT could not map its code buffer
+   for the handle. */
+ARMSIM_API int  armsim_engine (armsim_t *sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
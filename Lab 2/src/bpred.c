@@ -0,0 +1,228 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  Branch predictor models (-bpred). Every conditional branch the
+  interpreter executes is shown to all configured predictors, which
+  predict, are scored and then trained on the real outcome. Unconditional
+  branches are always right in any of these models and are not counted.
+
+    taken                       always predict taken
+    bimodal[:entries]           2-bit counters indexed by pc
+    gshare[:entries[:hist]]     2-bit counters indexed by pc ^ history
+    tournament[:entries[:hist]] bimodal and gshare with a 2-bit chooser
+    btb[:entries]               direct-mapped target buffer with a
+                                2-bit counter per entry; a miss predicts
+                                not taken, a taken hit must also have
+                                the right target
+    all                         one of each with the default sizes
+
+  Table sizes are powers of two; counters start weakly not taken.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell.h"
+#include "sim.h"
+
+#define BP_MAX 16
+
+enum { BP_TAKEN, BP_BIMODAL, BP_GSHARE, BP_TOURNAMENT, BP_BTB };
+
+typedef struct {
+  char name[48];
+  int kind;
+  uint32_t mask, hist_mask, ghr;
+  uint8_t *pht, *pht2, *chooser;  /* 2-bit counters */
+  uint32_t *tag, *target;         /* BTB */
+  unsigned long long branches, mispredicts;
+} bpred_t;
+
+int BPRED_ON = FALSE;
+
+static bpred_t PRED[BP_MAX];
+static int NPRED;
+
+static void counter (uint8_t *c, int taken) {
+
+  if (taken && *c < 3)
+    (*c)++;
+  else if (!taken && *c > 0)
+    (*c)--;
+}
+
+static uint8_t *counters (uint32_t n) {
+
+  uint8_t *t = malloc(n);
+  memset(t, 1, n);
+  return t;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_add                                       */
+/*                                                             */
+/* Purpose   : Configure one predictor from a spec (see top).  */
+/*             Returns -1 on a bad spec.                       */
+/*                                                             */
+/***************************************************************/
+int bpred_add (const char *spec) {
+
+  static const char *KIND[] = { "taken", "bimodal", "gshare", "tournament",
+                                "btb" };
+  static const uint32_t ENTRIES[] = { 0, 4096, 4096, 4096, 256 };
+  uint32_t entries, hist;
+  const char *p;
+  bpred_t *b;
+  int kind;
+
+  if (!strcmp(spec, "all")) {
+    for (kind = 0; kind <= BP_BTB; kind++)
+      if (bpred_add(KIND[kind]) < 0)
+        return -1;
+    return 0;
+  }
+  for (kind = 0; kind <= BP_BTB; kind++)
+    if (!strncmp(spec, KIND[kind], strlen(KIND[kind])) &&
+        (spec[strlen(KIND[kind])] == '\0' || spec[strlen(KIND[kind])] == ':'))
+      break;
+  if (kind > BP_BTB || NPRED == BP_MAX)
+    return -1;
+
+  p = spec + strlen(KIND[kind]);
+  entries = ENTRIES[kind];
+  hist = 12;
+  if (*p == ':')
+    entries = strtoul(p + 1, (char **)&p, 0);
+  if (*p == ':')
+    hist = strtoul(p + 1, (char **)&p, 0);
+  if (*p != '\0' || hist > 30 ||
+      (kind != BP_TAKEN && (entries == 0 || (entries & (entries - 1)))))
+    return -1;
+
+  b = &PRED[NPRED++];
+  memset(b, 0, sizeof(*b));
+  b->kind = kind;
+  b->mask = entries - 1;
+  b->hist_mask = (1u << hist) - 1;
+  if (kind == BP_TAKEN)
+    sprintf(b->name, "taken");
+  else if (kind == BP_GSHARE || kind == BP_TOURNAMENT)
+    sprintf(b->name, "%s:%u:%u", KIND[kind], entries, hist);
+  else
+    sprintf(b->name, "%s:%u", KIND[kind], entries);
+
+  if (kind != BP_TAKEN)
+    b->pht = counters(entries);
+  if (kind == BP_TOURNAMENT) {
+    b->pht2 = counters(entries);
+    b->chooser = counters(entries);
+  }
+  if (kind == BP_BTB) {
+    b->tag = calloc(entries, sizeof(uint32_t));
+    b->target = calloc(entries, sizeof(uint32_t));
+  }
+  BPRED_ON = TRUE;
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_update                                    */
+/*                                                             */
+/* Purpose   : Score and train every predictor on one          */
+/*             conditional branch                              */
+/*                                                             */
+/***************************************************************/
+void bpred_update (uint32_t pc, uint32_t target, int taken) {
+
+  uint32_t i = pc >> 2, g;
+  int k, pred, bpred, gpred;
+
+  for (k = 0; k < NPRED; k++) {
+    bpred_t *b = &PRED[k];
+
+    b->branches++;
+    switch (b->kind) {
+    case BP_TAKEN:
+      pred = 1;
+      break;
+
+    case BP_BIMODAL:
+      pred = b->pht[i & b->mask] >= 2;
+      counter(&b->pht[i & b->mask], taken);
+      break;
+
+    case BP_GSHARE:
+      g = (i ^ b->ghr) & b->mask;
+      pred = b->pht[g] >= 2;
+      counter(&b->pht[g], taken);
+      b->ghr = ((b->ghr << 1) | taken) & b->hist_mask;
+      break;
+
+    case BP_TOURNAMENT:
+      g = (i ^ b->ghr) & b->mask;
+      bpred = b->pht[i & b->mask] >= 2;
+      gpred = b->pht2[g] >= 2;
+      pred = b->chooser[i & b->mask] >= 2 ? gpred : bpred;
+      if (bpred != gpred)
+        counter(&b->chooser[i & b->mask], gpred == taken);
+      counter(&b->pht[i & b->mask], taken);
+      counter(&b->pht2[g], taken);
+      b->ghr = ((b->ghr << 1) | taken) & b->hist_mask;
+      break;
+
+    default: /* BP_BTB */
+      g = i & b->mask;
+      pred = b->tag[g] == (pc | 1) && b->pht[g] >= 2;
+      if (pred && taken && b->target[g] != target)
+        pred = !taken; /* right direction, wrong target */
+      if (b->tag[g] == (pc | 1)) {
+        counter(&b->pht[g], taken);
+        if (taken)
+          b->target[g] = target;
+      } else if (taken) {
+        b->tag[g] = pc | 1;
+        b->target[g] = target;
+        b->pht[g] = 2;
+      }
+      break;
+    }
+    b->mispredicts += pred != taken;
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : bpred_report                                    */
+/*                                                             */
+/* Purpose   : Print accuracy and MPKI of every predictor      */
+/*                                                             */
+/***************************************************************/
+void bpred_report () {
+
+  double kinst = INSTRUCTION_COUNT / 1000.0;
+  int k;
+
+  if (!BPRED_ON)
+    return;
+  printf("\nBranch predictors: %llu conditional branches in %lld instructions\n",
+         PRED[0].branches, INSTRUCTION_COUNT);
+  printf("  %-24s %12s %9s %8s\n", "predictor", "mispredicts", "accuracy",
+         "MPKI");
+  for (k = 0; k < NPRED; k++) {
+    bpred_t *b = &PRED[k];
+    printf("  %-24s %12llu %8.2f%% %8.3f\n", b->name, b->mispredicts,
+           b->branches ? 100.0 * (b->branches - b->mispredicts) / b->branches
+                       : 100.0,
+           kinst > 0 ? b->mispredicts / kinst : 0.0);
+  }
+}
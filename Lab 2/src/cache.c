@@ -0,0 +1,280 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  Set-associative L1 models (cache.h). Write-back caches allocate on
+  write misses and count a writeback when a dirty line is evicted;
+  write-through caches send every store on and do not allocate on a
+  write miss. The line that hit last is remembered, so runs of accesses
+  to one line (straight-line fetch, array walks) skip the tag search.
+  It is already the most recently used line, so no replacement state
+  needs updating on that path.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell.h"
+#include "cache.h"
+
+cache_t *ICACHE, *DCACHE;
+int CACHE_ON = FALSE;
+
+static int log2_exact (uint32_t v) {
+
+  int k = 0;
+
+  if (v == 0 || (v & (v - 1)))
+    return -1;
+  while ((1u << k) != v)
+    k++;
+  return k;
+}
+
+static uint32_t parse_size (const char *s, char **end) {
+
+  uint32_t v = strtoul(s, end, 0);
+
+  if (**end == 'k' || **end == 'K') {
+    v <<= 10;
+    (*end)++;
+  } else if (**end == 'm' || **end == 'M') {
+    v <<= 20;
+    (*end)++;
+  }
+  return v;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_create                                    */
+/*                                                             */
+/* Purpose   : Build a cache from a spec string; NULL and a    */
+/*             message if the geometry is not usable           */
+/*                                                             */
+/***************************************************************/
+cache_t *cache_create (const char *name, const char *spec) {
+
+  cache_t *c = calloc(1, sizeof(cache_t));
+  char *p;
+
+  c->name = name;
+  c->write_back = TRUE;
+  c->size = parse_size(spec, &p);
+  if (*p++ != ':')
+    goto bad;
+  c->ways = strtoul(p, &p, 0);
+  if (*p++ != ':')
+    goto bad;
+  c->line = parse_size(p, &p);
+  if (*p == ':') {
+    p++;
+    if (!strncmp(p, "lru", 3)) {
+      c->policy = CACHE_LRU;
+      p += 3;
+    } else if (!strncmp(p, "plru", 4)) {
+      c->policy = CACHE_PLRU;
+      p += 4;
+    } else if (!strncmp(p, "random", 6)) {
+      c->policy = CACHE_RANDOM;
+      p += 6;
+    } else {
+      goto bad;
+    }
+    if (!strcmp(p, ":wt")) {
+      c->write_back = FALSE;
+      p += 3;
+    } else if (!strcmp(p, ":wb")) {
+      p += 3;
+    }
+  }
+  if (*p != '\0' || log2_exact(c->line) < 2 || c->ways == 0 ||
+      c->size % (c->ways * c->line) || log2_exact(c->size / (c->ways * c->line)) < 0)
+    goto bad;
+  if (c->policy == CACHE_PLRU && (log2_exact(c->ways) < 0 || c->ways > 64))
+    goto bad;
+
+  c->sets = c->size / (c->ways * c->line);
+  c->line_bits = log2_exact(c->line);
+  c->set_mask = c->sets - 1;
+  c->tags = calloc(c->sets * c->ways, sizeof(uint32_t));
+  c->dirty = calloc(c->sets * c->ways, sizeof(uint8_t));
+  c->stamp = calloc(c->sets * c->ways, sizeof(uint64_t));
+  c->tree = calloc(c->sets, sizeof(uint64_t));
+  c->rng = 0x2545F491;
+  return c;
+
+ bad:
+  printf("Error: bad %s spec %s (size:ways:line[:lru|plru|random[:wb|wt]],"
+         " powers of two)\n", name, spec);
+  free(c);
+  return NULL;
+}
+
+/* Tree PLRU: bit set means the victim is in the right half. */
+static void plru_touch (cache_t *c, uint32_t set, uint32_t way) {
+
+  uint64_t t = c->tree[set];
+  uint32_t node = 1, span = c->ways;
+
+  while (span > 1) {
+    span >>= 1;
+    if (way & span) {
+      t &= ~(1ull << node);   /* used right: victim on the left */
+      node = 2 * node + 1;
+    } else {
+      t |= 1ull << node;
+      node = 2 * node;
+    }
+  }
+  c->tree[set] = t;
+}
+
+static uint32_t plru_victim (cache_t *c, uint32_t set) {
+
+  uint64_t t = c->tree[set];
+  uint32_t node = 1, way = 0, span = c->ways;
+
+  while (span > 1) {
+    span >>= 1;
+    if (t & (1ull << node)) {
+      way |= span;
+      node = 2 * node + 1;
+    } else {
+      node = 2 * node;
+    }
+  }
+  return way;
+}
+
+static void touch (cache_t *c, uint32_t set, uint32_t index) {
+
+  if (c->policy == CACHE_LRU)
+    c->stamp[index] = ++c->clock;
+  else if (c->policy == CACHE_PLRU)
+    plru_touch(c, set, index - set * c->ways);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_access                                    */
+/*                                                             */
+/* Purpose   : Look up one access and update the counters and  */
+/*             replacement state                               */
+/*                                                             */
+/***************************************************************/
+void cache_access (cache_t *c, uint32_t address, int store) {
+
+  uint32_t line = (address >> c->line_bits) + 1;
+  uint32_t set = (line - 1) & c->set_mask, base = set * c->ways;
+  uint32_t *tags = c->tags + base, w, victim;
+
+  if (store)
+    c->writes++;
+  else
+    c->reads++;
+
+  if (line == c->mru_line) {
+    if (store && c->write_back)
+      c->dirty[c->mru_index] = 1;
+    else if (store)
+      c->write_throughs++;
+    return;
+  }
+
+  for (w = 0; w < c->ways; w++)
+    if (tags[w] == line) {
+      touch(c, set, base + w);
+      if (store && c->write_back)
+        c->dirty[base + w] = 1;
+      else if (store)
+        c->write_throughs++;
+      c->mru_line = line;
+      c->mru_index = base + w;
+      return;
+    }
+
+  /* miss */
+  if (store) {
+    c->write_misses++;
+    if (!c->write_back) {
+      c->write_throughs++;
+      return;
+    }
+  } else {
+    c->read_misses++;
+  }
+
+  for (w = 0; w < c->ways && tags[w]; w++);
+  if (w < c->ways) {
+    victim = w;
+  } else if (c->policy == CACHE_LRU) {
+    for (victim = 0, w = 1; w < c->ways; w++)
+      if (c->stamp[base + w] < c->stamp[base + victim])
+        victim = w;
+  } else if (c->policy == CACHE_PLRU) {
+    victim = plru_victim(c, set);
+  } else {
+    c->rng ^= c->rng << 13;
+    c->rng ^= c->rng >> 17;
+    c->rng ^= c->rng << 5;
+    victim = c->rng % c->ways;
+  }
+  if (tags[victim] && c->dirty[base + victim])
+    c->writebacks++;
+  tags[victim] = line;
+  c->dirty[base + victim] = store;
+  touch(c, set, base + victim);
+  c->mru_line = line;
+  c->mru_index = base + victim;
+}
+
+static void report_one (FILE *out, cache_t *c) {
+
+  static const char *POLICY[] = { "LRU", "PLRU", "random" };
+  unsigned long long acc = c->reads + c->writes;
+  unsigned long long miss = c->read_misses + c->write_misses;
+
+  fprintf(out, "%s: %u bytes, %u-way, %u-byte lines, %u sets, %s%s\n",
+          c->name, c->size, c->ways, c->line, c->sets, POLICY[c->policy],
+          c == ICACHE ? "" : c->write_back ? ", write-back" : ", write-through");
+  fprintf(out, "  accesses   : %llu (%llu reads, %llu writes)\n",
+          acc, c->reads, c->writes);
+  fprintf(out, "  hits       : %llu\n", acc - miss);
+  fprintf(out, "  misses     : %llu (%llu read, %llu write), %.2f%%\n",
+          miss, c->read_misses, c->write_misses,
+          acc ? 100.0 * miss / acc : 0.0);
+  if (c == ICACHE)
+    return;
+  if (c->write_back)
+    fprintf(out, "  writebacks : %llu\n", c->writebacks);
+  else
+    fprintf(out, "  writes to memory : %llu\n", c->write_throughs);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : cache_report                                    */
+/*                                                             */
+/* Purpose   : Print the counters of every configured cache    */
+/*                                                             */
+/***************************************************************/
+void cache_report (FILE *out) {
+
+  if (!CACHE_ON) {
+    fprintf(out, "No caches configured (-icache, -dcache)\n\n");
+    return;
+  }
+  if (ICACHE)
+    report_one(out, ICACHE);
+  if (DCACHE)
+    report_one(out, DCACHE);
+  fprintf(out, "\n");
+}
@@ -0,0 +1,55 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_CACHE_H_
+#define _SIM_CACHE_H_
+
+/*
+  L1 cache models (-icache, -dcache). They only count: memory contents
+  always come from the region buffers. Tags are kept structure-of-
+  arrays, one uint32_t per way holding line address + 1 (0 = invalid),
+  so a lookup scans a single contiguous run of words.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CACHE_LRU    0
+#define CACHE_PLRU   1 /* tree pseudo-LRU */
+#define CACHE_RANDOM 2
+
+typedef struct {
+  const char *name;
+  uint32_t size, ways, line;    /* bytes, ways, bytes */
+  int policy;
+  int write_back;               /* else write-through, no write-allocate */
+
+  uint32_t sets, line_bits, set_mask;
+  uint32_t *tags;               /* sets * ways */
+  uint8_t  *dirty;              /* sets * ways */
+  uint64_t *stamp;              /* LRU: last use, sets * ways */
+  uint64_t *tree;               /* PLRU: one bit per tree node, per set */
+  uint64_t clock;
+  uint32_t rng;
+  uint32_t mru_line;            /* line address + 1 of the last hit */
+  uint32_t mru_index;
+
+  unsigned long long reads, writes, read_misses, write_misses;
+  unsigned long long writebacks, write_throughs;
+} cache_t;
+
+extern cache_t *ICACHE, *DCACHE;
+extern int CACHE_ON;
+
+/* "size:ways:line[:lru|plru|random[:wb|wt]]", size may end in k or m */
+cache_t *cache_create (const char *name, const char *spec);
+void     cache_access (cache_t *c, uint32_t address, int store);
+void     cache_report (FILE *out);
+
+#endif
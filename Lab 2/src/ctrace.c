@@ -0,0 +1,178 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  Commit-trace recorder (-ctrace). The simulation thread only fills
+  fixed-size record blocks. A full block is handed to a writer thread
+  through a single-producer single-consumer ring of blocks; the writer
+  encodes, compresses and writes it. HEAD and TAIL count published and
+  written blocks and are the only shared variables, so neither side
+  takes a lock. If the writer falls a whole ring behind, the simulator
+  yields until a slot frees up and counts it as a stall.
+*/
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "shell.h"
+#include "tracefmt.h"
+
+#define CT_RING 64 /* blocks in flight */
+
+int CTRACE_ON = FALSE;
+
+static FILE *OUT;
+static pthread_t WRITER;
+static ctrace_rec_t *BLOCKS;         /* CT_RING blocks of CT_BLOCK_RECS */
+static int COUNT[CT_RING];           /* records in each published block */
+static unsigned HEAD, TAIL;          /* blocks published / written      */
+static int DONE;
+static int FILL;                     /* records in the block being filled */
+static unsigned long long RECORDS, STALLS, BYTES;
+
+/* memory access of the instruction being executed */
+static int MEM_FLAGS;
+static uint32_t MEM_ADDR, MEM_DATA;
+
+static void *writer_main (void *arg) {
+
+  uint8_t *raw = malloc(CT_BLOCK_RECS * CT_REC_MAX);
+  uint8_t *comp = malloc(LZ_BOUND(CT_BLOCK_RECS * CT_REC_MAX));
+  struct timespec idle = { 0, 200000 };
+
+  for (;;) {
+    unsigned head = __atomic_load_n(&HEAD, __ATOMIC_ACQUIRE);
+    ctrace_block_t hdr;
+
+    if (TAIL == head) {
+      if (__atomic_load_n(&DONE, __ATOMIC_ACQUIRE) &&
+          TAIL == __atomic_load_n(&HEAD, __ATOMIC_ACQUIRE))
+        break;
+      nanosleep(&idle, NULL);
+      continue;
+    }
+    hdr.nrec = COUNT[TAIL % CT_RING];
+    hdr.raw_len = ctrace_encode(BLOCKS + (size_t)(TAIL % CT_RING) * CT_BLOCK_RECS,
+                                hdr.nrec, raw);
+    __atomic_store_n(&TAIL, TAIL + 1, __ATOMIC_RELEASE);
+
+    hdr.comp_len = lz_compress(raw, hdr.raw_len, comp);
+    if (hdr.comp_len >= hdr.raw_len)
+      hdr.comp_len = hdr.raw_len;
+    fwrite(&hdr, sizeof(hdr), 1, OUT);
+    fwrite(hdr.comp_len == hdr.raw_len ? raw : comp, 1, hdr.comp_len, OUT);
+    BYTES += sizeof(hdr) + hdr.comp_len;
+  }
+  free(raw);
+  free(comp);
+  return NULL;
+}
+
+/* hand the block being filled to the writer */
+static void publish () {
+
+  COUNT[HEAD % CT_RING] = FILL;
+  __atomic_store_n(&HEAD, HEAD + 1, __ATOMIC_RELEASE);
+  FILL = 0;
+  while (HEAD - __atomic_load_n(&TAIL, __ATOMIC_ACQUIRE) == CT_RING) {
+    STALLS++;
+    sched_yield();
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ctrace_open                                     */
+/*                                                             */
+/* Purpose   : Start recording to a file. Returns -1 if the    */
+/*             file can't be created.                          */
+/*                                                             */
+/***************************************************************/
+int ctrace_open (const char *filename) {
+
+  if ((OUT = fopen(filename, "wb")) == NULL)
+    return -1;
+  fwrite(CTRACE_MAGIC, 1, 8, OUT);
+  BYTES = 8;
+  BLOCKS = malloc(sizeof(ctrace_rec_t) * CT_RING * CT_BLOCK_RECS);
+  pthread_create(&WRITER, NULL, writer_main, NULL);
+  CTRACE_ON = TRUE;
+  return 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ctrace_close                                    */
+/*                                                             */
+/* Purpose   : Flush the last block, wait for the writer and   */
+/*             report the file size                            */
+/*                                                             */
+/***************************************************************/
+void ctrace_close () {
+
+  if (!CTRACE_ON)
+    return;
+  CTRACE_ON = FALSE;
+  if (FILL)
+    publish();
+  __atomic_store_n(&DONE, 1, __ATOMIC_RELEASE);
+  pthread_join(WRITER, NULL);
+  fclose(OUT);
+  free(BLOCKS);
+  printf("Commit trace: %llu records, %llu bytes (%.2f bytes/record), "
+         "%llu writer stalls\n", RECORDS, BYTES,
+         RECORDS ? (double)BYTES / RECORDS : 0.0, STALLS);
+}
+
+void ctrace_mem (uint32_t address, uint32_t data, int store) {
+
+  MEM_FLAGS = CT_MEM | (store ? CT_STORE : 0);
+  MEM_ADDR = address;
+  MEM_DATA = data;
+}
+
+void ctrace_begin () {
+
+  MEM_FLAGS = 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : ctrace_commit                                   */
+/*                                                             */
+/* Purpose   : Record one retired instruction, given the state */
+/*             before it and the state it committed            */
+/*                                                             */
+/***************************************************************/
+void ctrace_commit (const CPU_State *pre, const CPU_State *post,
+                    uint32_t word) {
+
+  ctrace_rec_t *r = BLOCKS + (size_t)(HEAD % CT_RING) * CT_BLOCK_RECS + FILL;
+  int k;
+
+  r->pc = pre->PC;
+  r->word = word;
+  r->flags = MEM_FLAGS | ((post->CPSR >> 28) << 4);
+  r->mem_addr = MEM_ADDR;
+  r->mem_data = MEM_DATA;
+  for (k = 0; k < ARM_REGS - 1; k++)
+    if (post->REGS[k] != pre->REGS[k]) {
+      r->flags |= CT_RD;
+      r->rd = k;
+      r->rd_val = post->REGS[k];
+      break;
+    }
+  RECORDS++;
+  if (++FILL == CT_BLOCK_RECS)
+    publish();
+}
@@ -992,7 +992,7 @@ int CMP (int Rd, int Rn, int Operand2, int I, int S, int CC){
     if (cur > 0xFFFFFFFF)
       NEXT_STATE.CPSR |= C_N;
   }	
-  printf("Value of comparison: %d\nS=%d\nFLAGS: \nN: %d\nZ: %d\nV: %d\nC: %d\n", cur, S, N_N, Z_N, V_N, C_N);
+  TRACE(TRACE_FULL, "Value of comparison: %d\nS=%d\nFLAGS: \nN: %d\nZ: %d\nV: %d\nC: %d\n", cur, S, N_N, Z_N, V_N, C_N);
   return 0;
 }
 
@@ -1480,7 +1480,7 @@ int STR (int Rd, int Rn, int Operand2, int I){
   int cur = 0;
   int address = 0;
   int src2 = 0;
-  if (~I == 0){    //Immediate 
+  if (I == 0){    //Immediate 
     //imm12 = Operand2
     // address is value equal to [Rn, +- src2]
     //src2 = ...
@@ -1519,7 +1519,7 @@ int LDR (int Rd, int Rn, int Operand2, int I){
   int cur = 0;
   int address = 0;
   int src2 = 0;
-  if (~I == 0){    //Immediate 
+  if (I == 0){    //Immediate 
     //imm12 = Operand2
     // address is value equal to [Rn, +- src2]
     //src2 = ...
@@ -1550,7 +1550,7 @@ int LDR (int Rd, int Rn, int Operand2, int I){
       }     
   }
   address = CURRENT_STATE.REGS[Rn] + src2;
-  CURRENT_STATE.REGS[Rd] = mem_read_32(address);
+  NEXT_STATE.REGS[Rd] = mem_read_32(address);
   return 0;
 }
 
@@ -1558,7 +1558,7 @@ int STRB (int Rd, int Rn, int Operand2, int I){
   int cur = 0;
   int address = 0;
   int src2 = 0;
-  if (~I == 0){    //Immediate 
+  if (I == 0){    //Immediate 
     //imm12 = Operand2
     // address is value equal to [Rn, +- src2]
     //src2 = ...
@@ -1597,7 +1597,7 @@ int LDRB (int Rd, int Rn, int Operand2, int I){
   int cur = 0;
   int address = 0;
   int src2 = 0;
-  if (~I == 0){    //Immediate 
+  if (I == 0){    //Immediate 
     //imm12 = Operand2
     // address is value equal to [Rn, +- src2]
     //src2 = ...
@@ -1628,7 +1628,7 @@ int LDRB (int Rd, int Rn, int Operand2, int I){
       }     
   }
   address = CURRENT_STATE.REGS[Rn] + src2;
-  CURRENT_STATE.REGS[Rd] = mem_read_32(address) & 0xFF;
+  NEXT_STATE.REGS[Rd] = mem_read_32(address) & 0xFF;
   return 0;
 }
 /*
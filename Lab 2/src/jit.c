@@ -0,0 +1,378 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  x86-64 translator for hot basic blocks (ENGINE_JIT).
+
+  A block is translated into one host function. Data processing with
+  S=0 and cond AL (except ADC/SBC/RSC, register-shifted-register and
+  anything touching R15) and B/BL are emitted inline. Everything else
+  (flag setting, LDR/STR, conditional non-branch, SWI, multiply) is a
+  call to step_decoded(), which runs the isa.h handler exactly as the
+  interpreter does.
+
+  Inline code works on NEXT_STATE through rbx. Up to five guest
+  registers used by the inline instructions are pinned in the
+  callee-saved host registers ebp, r12d-r15d for the whole block and
+  spilled around every step_decoded() call. The isa.h flag handling is
+  sticky (bits are OR-ed in and never cleared) so NZCV cannot live in
+  host flags; conditional branches call cond_passed() instead, which
+  reads CURRENT_STATE.CPSR. CURRENT_STATE is brought in line with
+  NEXT_STATE at block exit, matching the per-instruction commit.
+
+  Every sim_ctx has its own code buffer, since the blocks have that
+  context's NEXT_STATE and CURRENT_STATE addresses built in; resetting
+  one context's buffer never touches code another context still runs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "shell.h"
+#include "sim.h"
+#include "jit.h"
+
+#if defined(__x86_64__)
+
+#define JIT_BUF_SIZE   (4 << 20)
+#define JIT_INST_BYTES 128 /* worst case per guest instruction */
+#define JIT_NPIN       5
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RDI 7
+
+#define DISP_REG(r) ((int)offsetof(CPU_State, REGS) + 4 * (r))
+#define DISP_PC     DISP_REG(15)
+
+static const int PIN_HOST[JIT_NPIN] = { 5, 12, 13, 14, 15 };
+
+#define BUF      (SIM->jit_buf)
+#define USED     (SIM->jit_used)
+#define DISABLED (SIM->jit_failed)
+
+static __thread uint8_t *P;         /* emit pointer */
+static __thread int      PIN[15];   /* host register holding guest reg, or -1 */
+
+static void emit8 (uint8_t b) { *P++ = b; }
+
+static void emit32 (uint32_t v) { memcpy(P, &v, 4); P += 4; }
+
+static void emit64 (uint64_t v) { memcpy(P, &v, 8); P += 8; }
+
+static void emit_rex (int reg, int rm) {
+
+  if(reg >= 8 || rm >= 8)
+    emit8(0x40 | ((reg >> 3) << 2) | (rm >> 3));
+}
+
+/* op r/m32(dst), r32(src) for mov/add/or/and/sub/xor */
+static void emit_rr (uint8_t opc, int dst, int src) {
+
+  if(opc == 0x89 && dst == src)
+    return;
+  emit_rex(src, dst);
+  emit8(opc);
+  emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void emit_mov_ri (int host, uint32_t imm) {
+
+  emit_rex(0, host);
+  emit8(0xB8 | (host & 7));
+  emit32(imm);
+}
+
+static void emit_movabs (int host, uint64_t imm) {
+
+  emit8(0x48 | (host >> 3));
+  emit8(0xB8 | (host & 7));
+  emit64(imm);
+}
+
+/* opc = 0x8B load, 0x89 store, between host and [rbx+disp8] */
+static void emit_mem (uint8_t opc, int host, int disp) {
+
+  emit_rex(host, 0);
+  emit8(opc);
+  emit8(0x40 | ((host & 7) << 3) | RBX);
+  emit8(disp);
+}
+
+static void emit_load (int host, int guest) {
+
+  if(PIN[guest] >= 0)
+    emit_rr(0x89, host, PIN[guest]);
+  else
+    emit_mem(0x8B, host, DISP_REG(guest));
+}
+
+static void emit_store (int guest, int host) {
+
+  if(PIN[guest] >= 0)
+    emit_rr(0x89, PIN[guest], host);
+  else
+    emit_mem(0x89, host, DISP_REG(guest));
+}
+
+static void emit_store_imm (int guest, uint32_t imm) {
+
+  if(guest < 15 && PIN[guest] >= 0) {
+    emit_mov_ri(PIN[guest], imm);
+  } else {
+    emit8(0xC7);
+    emit8(0x43);
+    emit8(DISP_REG(guest));
+    emit32(imm);
+  }
+}
+
+static void emit_not (int host) {
+
+  emit_rex(0, host);
+  emit8(0xF7);
+  emit8(0xD0 | (host & 7));
+}
+
+/* ext: 4 shl, 5 shr, 1 ror */
+static void emit_shift (int host, int ext, int amount) {
+
+  if(amount == 0)
+    return;
+  emit_rex(0, host);
+  emit8(0xC1);
+  emit8(0xC0 | (ext << 3) | (host & 7));
+  emit8(amount);
+}
+
+static void emit_call (void *fn) {
+
+  emit_movabs(RAX, (uint64_t)(uintptr_t)fn);
+  emit8(0xFF);
+  emit8(0xD0);
+}
+
+static void spill_pinned () {
+
+  int g;
+  for(g = 0; g < 15; g++)
+    if(PIN[g] >= 0)
+      emit_mem(0x89, PIN[g], DISP_REG(g));
+}
+
+static void reload_pinned () {
+
+  int g;
+  for(g = 0; g < 15; g++)
+    if(PIN[g] >= 0)
+      emit_mem(0x8B, PIN[g], DISP_REG(g));
+}
+
+static int uses_pc (inst_t *d) {
+
+  if(d->Rd == 15 || d->Rn == 15)
+    return 1;
+  return !d->I && (d->Operand2 & 0xF) == 15;
+}
+
+/* Data processing that can be emitted inline. */
+static int inline_data (inst_t *d) {
+
+  if(d->exec != data_process || d->cond != 14 || d->S)
+    return 0;
+  if(d->cmd >= 5 && d->cmd <= 11) /* ADC SBC RSC TST TEQ CMP CMN */
+    return 0;
+  if(!d->I && (d->Operand2 & 0x10)) /* register-shifted register */
+    return 0;
+  return !uses_pc(d);
+}
+
+static int inline_branch (inst_t *d) {
+
+  int L = (d->word >> 24) & 0x1;
+  return d->exec == branch_process && (!L || d->cond == 14);
+}
+
+static void choose_pins (inst_t **insts, int n) {
+
+  int count[15] = { 0 };
+  int i, k, g, best;
+
+  for(i = 0; i < n; i++) {
+    if(!inline_data(insts[i]))
+      continue;
+    count[insts[i]->Rd]++;
+    count[insts[i]->Rn]++;
+    if(!insts[i]->I)
+      count[insts[i]->Operand2 & 0xF]++;
+  }
+  for(g = 0; g < 15; g++)
+    PIN[g] = -1;
+  for(k = 0; k < JIT_NPIN; k++) {
+    best = -1;
+    for(g = 0; g < 15; g++)
+      if(PIN[g] < 0 && count[g] > 0 && (best < 0 || count[g] > count[best]))
+        best = g;
+    if(best < 0)
+      break;
+    PIN[best] = PIN_HOST[k];
+  }
+}
+
+static void emit_data (inst_t *d) {
+
+  /* ecx <- Operand2, following the isa.h shifter (ASR is logical there) */
+  if(d->cmd != 15) {
+    if(d->I) {
+      emit_mov_ri(RCX, d->imm);
+    } else {
+      static const int SHIFT_EXT[4] = { 4, 5, 5, 1 };
+      emit_load(RCX, d->Operand2 & 0xF);
+      emit_shift(RCX, SHIFT_EXT[(d->Operand2 >> 5) & 0x3],
+                 (d->Operand2 >> 7) & 0x1F);
+    }
+  }
+  if(d->cmd != 13)
+    emit_load(RAX, d->Rn);
+
+  switch(d->cmd) {
+  case 0:  emit_rr(0x21, RAX, RCX); break;                     /* AND */
+  case 1:  emit_rr(0x31, RAX, RCX); break;                     /* EOR */
+  case 2:  emit_rr(0x29, RAX, RCX); break;                     /* SUB */
+  case 3:  emit_rr(0x29, RCX, RAX); emit_rr(0x89, RAX, RCX); break; /* RSB */
+  case 4:  emit_rr(0x01, RAX, RCX); break;                     /* ADD */
+  case 12: emit_rr(0x09, RAX, RCX); break;                     /* ORR */
+  case 13: emit_rr(0x89, RAX, RCX); break;                     /* MOV */
+  case 14: emit_not(RCX); emit_rr(0x21, RAX, RCX); break;      /* BIC */
+  case 15: emit_not(RAX); break;                     /* MVN (isa.h: ~Rn) */
+  }
+  emit_store(d->Rd, RAX);
+}
+
+static void emit_branch (inst_t *d, uint32_t pc) {
+
+  uint32_t target = pc + 8 + ((uint32_t)d->imm24 << 2);
+
+  if(d->cond == 14) {
+    if((d->word >> 24) & 0x1)
+      emit_store_imm(14, pc + 4);
+    emit_store_imm(15, target);
+    return;
+  }
+  emit_mov_ri(RDI, d->cond);
+  emit_call(cond_passed);
+  emit_mov_ri(RCX, pc + 4);
+  emit_mov_ri(RDX, target);
+  emit8(0x85); emit8(0xC0);              /* test eax, eax    */
+  emit8(0x0F); emit8(0x45); emit8(0xCA); /* cmovnz ecx, edx  */
+  emit_mem(0x89, RCX, DISP_PC);
+}
+
+jit_fn jit_compile (uint32_t pc, inst_t **insts, int n) {
+
+  uint8_t *start;
+  int i, k, pc_valid = 0;
+
+  if(DISABLED)
+    return NULL;
+  if(BUF == NULL) {
+    BUF = mmap(NULL, JIT_BUF_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(BUF == MAP_FAILED) {
+      /* reported by the shell (report_speed) or armsim_engine() */
+      BUF = NULL;
+      DISABLED = 1;
+      return NULL;
+    }
+  }
+  if(USED + (size_t)(n + 4) * JIT_INST_BYTES > JIT_BUF_SIZE)
+    return NULL;
+
+  start = P = BUF + USED;
+  choose_pins(insts, n);
+
+  /* prologue: save callee-saved registers, keep rsp 16-byte aligned */
+  emit8(0x53); emit8(0x55);
+  emit8(0x41); emit8(0x54); emit8(0x41); emit8(0x55);
+  emit8(0x41); emit8(0x56); emit8(0x41); emit8(0x57);
+  emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08);
+  emit_movabs(RBX, (uint64_t)(uintptr_t)&NEXT_STATE);
+  reload_pinned();
+
+  for(i = 0; i < n; i++, pc += 4) {
+    inst_t *d = insts[i];
+
+    if(inline_data(d)) {
+      emit_data(d);
+      pc_valid = 0;
+    } else if(inline_branch(d)) {
+      emit_branch(d, pc);
+      pc_valid = 1;
+    } else {
+      emit_store_imm(15, pc);
+      spill_pinned();
+      emit_movabs(RDI, (uint64_t)(uintptr_t)d);
+      emit_call(step_decoded);
+      reload_pinned();
+      pc_valid = 1;
+    }
+  }
+  if(!pc_valid)
+    emit_store_imm(15, pc);
+
+  /* epilogue: spill, CURRENT_STATE = NEXT_STATE, return count */
+  spill_pinned();
+  emit_movabs(RCX, (uint64_t)(uintptr_t)&CURRENT_STATE);
+  for(k = 0; k < (int)sizeof(CPU_State); k += 4) {
+    emit_mem(0x8B, RAX, k);
+    emit8(0x89); emit8(0x41); emit8(k);   /* mov [rcx+k], eax */
+  }
+  emit_mov_ri(RAX, n);
+  emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08);
+  emit8(0x41); emit8(0x5F); emit8(0x41); emit8(0x5E);
+  emit8(0x41); emit8(0x5D); emit8(0x41); emit8(0x5C);
+  emit8(0x5D); emit8(0x5B);
+  emit8(0xC3);
+
+  USED = (P - BUF + 15) & ~(size_t)15;
+  return (jit_fn)(void *)start;
+}
+
+void jit_reset () {
+
+  USED = 0;
+}
+
+void jit_release () {
+
+  if(BUF != NULL)
+    munmap(BUF, JIT_BUF_SIZE);
+  BUF = NULL;
+  USED = 0;
+}
+
+#else
+
+jit_fn jit_compile (uint32_t pc, inst_t **insts, int n) {
+
+  return NULL;
+}
+
+void jit_reset () {
+}
+
+void jit_release () {
+}
+
+#endif
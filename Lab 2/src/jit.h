@@ -0,0 +1,35 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_JIT_H_
+#define _SIM_JIT_H_
+
+#include <stdint.h>
+#include "sim.h"
+
+/* Translated block: runs and commits every instruction, returns count. */
+typedef int (*jit_fn)(void);
+
+/*
+  Translate the n decoded instructions of the block starting at pc into
+  x86-64 host code. Returns NULL when the host is not x86-64 or the code
+  buffer is full; the caller keeps interpreting the block. If the buffer
+  cannot be mapped at all, SIM->jit_failed is set and the context stays
+  on threaded code. Nothing is printed.
+*/
+jit_fn jit_compile (uint32_t pc, inst_t **insts, int n);
+
+/* Drop all of the current context's translated code (text was
+   modified). */
+void jit_reset ();
+
+/* Unmap the current context's code buffer (sim_ctx_destroy). */
+void jit_release ();
+
+#endif
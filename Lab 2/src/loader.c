@@ -0,0 +1,281 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  Program loading. read_program() maps the file and tells the format
+  from its contents:
+
+    ELF  32-bit ARM, either byte order. Executables are loaded by
+         PT_LOAD segment at their own addresses and start at e_entry.
+         Relocatable objects (arm-none-eabi-as output, as used by
+         arm2hex) carry no addresses, so executable sections are packed
+         from the start of text and every other allocated section from
+         the start of data, in section order. Relocations are not
+         applied.
+    .x   hex words separated by white space (arm2hex output).
+    raw  anything else: big-endian words from the start of text.
+
+  Everything is copied straight into the region buffers, which hold
+  little-endian words. Big-endian images are byte-swapped per word on
+  the way in, so a word reads back exactly as the assembler wrote it,
+  the same as a .x file.
+*/
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shell.h"
+
+#define EM_ARM        40
+#define ET_REL        1
+#define ET_EXEC       2
+#define PT_LOAD       1
+#define SHT_NOBITS    8
+#define SHF_ALLOC     0x2
+#define SHF_EXECINSTR 0x4
+
+static __thread int BIG; /* byte order of the image being loaded */
+
+/* the caller's buffer for why a load failed (read_program) */
+static __thread char *ERROR;
+static __thread size_t ERROR_LEN;
+
+static int load_error (const char *fmt, ...) {
+
+  va_list ap;
+
+  if (ERROR != NULL) {
+    va_start(ap, fmt);
+    vsnprintf(ERROR, ERROR_LEN, fmt, ap);
+    va_end(ap);
+  }
+  return -1;
+}
+
+static uint32_t get16 (const uint8_t *p) {
+
+  return BIG ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t get32 (const uint8_t *p) {
+
+  return BIG ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+             : ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+/* Host address of guest [addr, addr + len) if one region holds it all. */
+static uint8_t *region_span (uint32_t addr, uint32_t len) {
+
+  int i;
+
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    mem_region_t *r = &MEM_REGIONS[i];
+    if (addr - r->start < r->size && len <= r->size - (addr - r->start))
+      return r->mem + (addr - r->start);
+  }
+  return NULL;
+}
+
+/*
+  Copy filesz bytes of the image to guest addr and zero up to memsz.
+  Returns -1 if filesz > memsz or no single region holds the whole
+  range (which also rules out a range that wraps past 4 GB).
+*/
+static int copy_in (uint32_t addr, const uint8_t *src, uint32_t filesz,
+                    uint32_t memsz) {
+
+  uint32_t off = addr & 3, k = 0;
+  uint8_t *base;
+
+  if (filesz > memsz || memsz > UINT32_MAX - off ||
+      (base = region_span(addr - off, memsz + off)) == NULL)
+    return -1;
+
+  if (!BIG) {
+    if (filesz)
+      memcpy(base + off, src, filesz);
+    k = filesz;
+  } else {
+    /* byte i of a big-endian word is byte 3 - i of a little-endian one */
+    for (; k < filesz && ((off + k) & 3); k++)
+      base[(off + k) ^ 3] = src[k];
+    for (; k + 4 <= filesz; k += 4) {
+      uint8_t *d = base + off + k;
+      d[0] = src[k + 3]; d[1] = src[k + 2]; d[2] = src[k + 1]; d[3] = src[k];
+    }
+    for (; k < filesz; k++)
+      base[(off + k) ^ 3] = src[k];
+  }
+  memset(base + off + k, 0, memsz - k);
+  return 0;
+}
+
+static int load_elf (const uint8_t *img, size_t size, const char *filename) {
+
+  uint32_t phoff, shoff, text, data, total = 0;
+  int type, i, n, entsize;
+
+  if (size < 52)
+    return load_error("%s is not a 32-bit ARM executable or object", filename);
+  BIG = img[5] == 2;
+  type = get16(img + 16);
+  if (img[4] != 1 || get16(img + 18) != EM_ARM ||
+      (type != ET_EXEC && type != ET_REL))
+    return load_error("%s is not a 32-bit ARM executable or object", filename);
+
+  if (type == ET_EXEC) {
+    phoff = get32(img + 28);
+    entsize = get16(img + 42);
+    n = get16(img + 44);
+    if (entsize < 32 || (size_t)phoff + (size_t)n * entsize > size)
+      return load_error("%s: truncated program headers", filename);
+    for (i = 0; i < n; i++) {
+      const uint8_t *ph = img + phoff + i * entsize;
+      uint32_t offset = get32(ph + 4), vaddr = get32(ph + 8);
+      uint32_t filesz = get32(ph + 16), memsz = get32(ph + 20);
+
+      if (get32(ph) != PT_LOAD || memsz == 0)
+        continue;
+      if ((size_t)offset + filesz > size ||
+          copy_in(vaddr, img + offset, filesz, memsz) < 0)
+        return load_error("%s: segment at 0x%08x does not fit in memory",
+                          filename, vaddr);
+      total += memsz;
+    }
+    CURRENT_STATE.PC = get32(img + 24);
+    return total / 4;
+  }
+
+  /* relocatable: pack sections into text and data */
+  text = MEM_REGIONS[REGION_TEXT].start;
+  data = MEM_REGIONS[REGION_DATA].start;
+  shoff = get32(img + 32);
+  entsize = get16(img + 46);
+  n = get16(img + 48);
+  if (entsize < 40 || (size_t)shoff + (size_t)n * entsize > size)
+    return load_error("%s: truncated section headers", filename);
+  for (i = 0; i < n; i++) {
+    const uint8_t *sh = img + shoff + i * entsize;
+    uint32_t flags = get32(sh + 8), offset = get32(sh + 16);
+    uint32_t len = get32(sh + 20), align = get32(sh + 32);
+    uint32_t *at = (flags & SHF_EXECINSTR) ? &text : &data;
+
+    if (!(flags & SHF_ALLOC) || len == 0)
+      continue;
+    if (align > 1)
+      *at = (*at + align - 1) & ~(align - 1);
+    if (get32(sh + 4) == SHT_NOBITS ? copy_in(*at, NULL, 0, len) < 0 :
+        (size_t)offset + len > size || copy_in(*at, img + offset, len, len) < 0)
+      return load_error("%s: section %d does not fit in memory", filename, i);
+    *at += len;
+    total += len;
+  }
+  CURRENT_STATE.PC = MEM_REGIONS[REGION_TEXT].start;
+  return total / 4;
+}
+
+/* .x text: hex words, optionally 0x-prefixed, separated by white space */
+static int load_hex (const char *p, const char *end) {
+
+  mem_region_t *t = &MEM_REGIONS[REGION_TEXT];
+  uint32_t addr = t->start, word;
+  int n = 0, digits;
+
+  for (;;) {
+    while (p < end && isspace((unsigned char)*p))
+      p++;
+    if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+      p += 2;
+    for (word = 0, digits = 0; p < end && isxdigit((unsigned char)*p);
+         p++, digits++)
+      word = (word << 4) | (isdigit((unsigned char)*p) ? *p - '0'
+                                                       : (*p | 0x20) - 'a' + 10);
+    if (digits == 0)
+      break;
+
+    if (addr - t->start <= t->size - 4) {
+      uint8_t *d = t->mem + (addr - t->start);
+      d[0] = word; d[1] = word >> 8; d[2] = word >> 16; d[3] = word >> 24;
+    } else {
+      mem_write_32(addr, word);
+    }
+    addr += 4;
+    n++;
+  }
+  CURRENT_STATE.PC = t->start;
+  return n;
+}
+
+static int is_hex_text (const uint8_t *img, size_t size) {
+
+  size_t k;
+
+  for (k = 0; k < size && k < 256; k++)
+    if (!isxdigit(img[k]) && !isspace(img[k]) && img[k] != 'x' &&
+        img[k] != 'X')
+      return 0;
+  return 1;
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : read_program                                   */
+/*                                                            */
+/* Purpose   : Load an ELF, .x or raw program without output. */
+/*             Returns the words loaded, -1 on any error with */
+/*             the reason in error (unless NULL).             */
+/*                                                            */
+/**************************************************************/
+int read_program (char *program_filename, char *error, size_t len) {
+
+  int fd, words;
+  struct stat st;
+  uint8_t *img;
+
+  ERROR = error;
+  ERROR_LEN = len;
+  if ((fd = open(program_filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0)
+      close(fd);
+    return load_error("Can't open program file %s", program_filename);
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    CURRENT_STATE.PC = MEM_REGIONS[REGION_TEXT].start;
+    return 0;
+  }
+  img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (img == MAP_FAILED)
+    return load_error("Can't map program file %s", program_filename);
+
+  if (st.st_size >= 16 && !memcmp(img, "\177ELF", 4)) {
+    words = load_elf(img, st.st_size, program_filename);
+  } else if (is_hex_text(img, st.st_size)) {
+    words = load_hex((const char *)img, (const char *)img + st.st_size);
+  } else {
+    BIG = 1;
+    CURRENT_STATE.PC = MEM_REGIONS[REGION_TEXT].start;
+    words = copy_in(CURRENT_STATE.PC, img, st.st_size, st.st_size) < 0 ?
+            load_error("%s does not fit in the text region", program_filename) :
+            (int)(st.st_size / 4);
+  }
+  munmap(img, st.st_size);
+
+  /* stores bypassed mem_write_32, so drop any predecoded text */
+  predecode_flush();
+  return words;
+}
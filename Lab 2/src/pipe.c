@@ -0,0 +1,267 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  Cycle count of the Lab 4 five-stage pipeline (-pipeline). Each
+  instruction the interpreter retires is decoded the way the controller
+  in arm_pipelined.sv decodes it (by Instr[27:26]) and run through the
+  equations of its hazard unit:
+
+    ldrStallD     the instruction in Execute has MemtoRegE and its
+                  Instr[15:12] matches RA1D or RA2D: one stall cycle
+    MispredictE   a branch the BTB in Fetch predicted wrongly (taken
+                  or not, or the target) flushes Decode and Execute:
+                  two cycles. The BTB is modelled entry for entry:
+                  PIPE_BTB direct-mapped entries indexed by PC+4, a
+                  2-bit counter each, a taken miss allocates weakly
+                  taken (PIPE_BTB 0: always predict not taken).
+                  A return (mov pc, lr) is predicted from a PIPE_RAS
+                  entry return-address stack instead, pushed by BL;
+                  here the stack changes at once, where the hardware
+                  updates it from Execute
+    PCWrPendingF  any other register write to R15 (PCSrcD) stalls
+                  Fetch and flushes Decode while it is in Decode and
+                  Execute: two cycles
+    PCSrcW        fetch is still stalled when it is in Execute, so the
+                  new PC is only picked up from ResultW: two more
+                  cycles while it is in Memory and Writeback
+
+  and ForwardAE/ForwardBE from Memory and Writeback are counted. The
+  rules are kept as the hardware has them, quirks included: RA2D is
+  Instr[3:0] even for immediates, STR also sets MemtoReg, and Rd is
+  Instr[15:12] for every instruction but BL (LR). Bubbles move through
+  the pipeline like instructions, so forwarding sees them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "shell.h"
+#include "sim.h"
+
+typedef struct {
+  int valid;       /* 0 for a bubble */
+  int wa3;         /* Instr[15:12] */
+  int memtoreg;    /* MemtoRegE, not gated by the condition */
+  int regwrite;    /* RegWriteM: gated by CondExE and compareOnly */
+} slot_t;
+
+typedef struct {
+  int valid;
+  uint32_t tag;    /* PC+4 of the branch */
+  uint32_t target;
+  int count;       /* 2-bit saturating, >= 2 predicts taken */
+} btb_entry_t;
+
+int PIPE_ON = FALSE;
+int PIPE_BTB = 16;     /* BTBEntries in arm_pipelined.sv */
+int PIPE_RAS = 4;      /* RASDepth */
+
+static slot_t OCC[2];  /* [0] entered Execute last, [1] the one before */
+static btb_entry_t *BTB;
+static uint32_t *RAS;
+static int RAS_TOS, RAS_COUNT;
+static unsigned long long INSTS, LDR_STALLS, PC_STALLS, PC_FLUSHES;
+static unsigned long long BRANCHES, MISPREDICTS, RETURNS, RET_MISPREDICTS;
+static unsigned long long FWD_M, FWD_W;
+
+static void advance (slot_t s) {
+
+  OCC[1] = OCC[0];
+  OCC[0] = s;
+}
+
+static void bubbles (int n) {
+
+  static const slot_t BUBBLE;
+
+  while (n--)
+    advance(BUBBLE);
+}
+
+static void forward (int ra) {
+
+  if (OCC[0].valid && OCC[0].regwrite && OCC[0].wa3 == ra)
+    FWD_M++;
+  else if (OCC[1].valid && OCC[1].regwrite && OCC[1].wa3 == ra)
+    FWD_W++;
+}
+
+/* Predict in Fetch, resolve and update in Execute; TRUE if the
+   prediction was wrong. */
+static int btb_branch (uint32_t pc, uint32_t target, int taken) {
+
+  btb_entry_t *e;
+  int hit, mispredict;
+
+  if (PIPE_BTB == 0)
+    return taken;
+  if (BTB == NULL)
+    BTB = calloc(PIPE_BTB, sizeof(btb_entry_t));
+  e = &BTB[((pc + 4) >> 2) & (PIPE_BTB - 1)];
+  hit = e->valid && e->tag == pc + 4;
+
+  if (taken)
+    mispredict = !(hit && e->count >= 2 && e->target == target);
+  else
+    mispredict = hit && e->count >= 2;
+
+  if (hit) {
+    if (taken) {
+      e->target = target;
+      if (e->count < 3)
+        e->count++;
+    } else if (e->count > 0) {
+      e->count--;
+    }
+  } else if (taken) {
+    e->valid = TRUE;
+    e->tag = pc + 4;
+    e->target = target;
+    e->count = 2;
+  }
+  return mispredict;
+}
+
+/* A taken BL pushes its PC+4 (a full stack drops the oldest). */
+static void ras_push (uint32_t link) {
+
+  if (PIPE_RAS == 0)
+    return;
+  if (RAS == NULL)
+    RAS = calloc(PIPE_RAS, sizeof(uint32_t));
+  RAS_TOS = (RAS_TOS + 1) & (PIPE_RAS - 1);
+  RAS[RAS_TOS] = link;
+  if (RAS_COUNT < PIPE_RAS)
+    RAS_COUNT++;
+}
+
+/* A return predicted from the top of the stack, popped if taken; TRUE
+   if the prediction was wrong. */
+static int ras_return (uint32_t target, int taken) {
+
+  int predicted = RAS_COUNT > 0;
+  int mispredict;
+
+  if (taken)
+    mispredict = !(predicted && RAS[RAS_TOS] == target);
+  else
+    mispredict = predicted;
+  if (taken && RAS_COUNT > 0) {
+    RAS_TOS = (RAS_TOS - 1) & (PIPE_RAS - 1);
+    RAS_COUNT--;
+  }
+  return mispredict;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : pipe_issue                                      */
+/*                                                             */
+/* Purpose   : Account for one instruction at pc; executed is  */
+/*             its condition against the flags before it ran   */
+/*                                                             */
+/***************************************************************/
+void pipe_issue (uint32_t pc, uint32_t word, int executed) {
+
+  int op = (word >> 26) & 0x3, load = (word >> 20) & 0x1;
+  int cmd = (word >> 21) & 0xF;
+  int branch = op == 2, link = branch && ((word >> 24) & 0x1);
+  int ret = (word & 0x0FFFFFFF) == 0x01A0F00E;     /* mov pc, lr */
+  int regwrite = (op == 0 && !ret) || (op == 1 && load) || link;
+  int ra1 = branch ? 15 : (word >> 16) & 0xF;
+  int ra2 = (op == 1 && !load) ? (word >> 12) & 0xF : word & 0xF;
+  slot_t s;
+
+  INSTS++;
+  s.valid = TRUE;
+  s.wa3 = link ? 14 : (word >> 12) & 0xF;
+  s.memtoreg = op == 1;
+  s.regwrite = regwrite && executed && !(op == 0 && cmd >= 8 && cmd <= 11);
+
+  /* Decode: load-use against the instruction now in Execute */
+  if (OCC[0].valid && OCC[0].memtoreg &&
+      (OCC[0].wa3 == ra1 || OCC[0].wa3 == ra2)) {
+    LDR_STALLS++;
+    bubbles(1);
+  }
+
+  /* Execute: operands from Memory, else Writeback */
+  forward(ra1);
+  forward(ra2);
+  advance(s);
+
+  if (branch) {
+    uint32_t target = pc + 8 + ((uint32_t)((int32_t)(word << 8) >> 6));
+
+    BRANCHES++;
+    if (btb_branch(pc, target, executed)) {
+      MISPREDICTS++;
+      bubbles(2);
+    }
+    if (link && executed)
+      ras_push(pc + 4);
+  } else if (ret) {
+    RETURNS++;
+    if (ras_return(CURRENT_STATE.REGS[14], executed)) {
+      RET_MISPREDICTS++;
+      bubbles(2);
+    }
+  } else if (regwrite && s.wa3 == 15) {
+    PC_STALLS += 2;
+    bubbles(2);
+    if (executed) {
+      PC_FLUSHES += 2;
+      bubbles(2);
+    }
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : pipe_report                                     */
+/*                                                             */
+/* Purpose   : Print cycles, CPI and where the stalls came     */
+/*             from                                            */
+/*                                                             */
+/***************************************************************/
+void pipe_report () {
+
+  unsigned long long stalls = LDR_STALLS + PC_STALLS + PC_FLUSHES +
+                              2 * (MISPREDICTS + RET_MISPREDICTS);
+  unsigned long long cycles = INSTS ? INSTS + stalls + 4 : 0;
+
+  if (!PIPE_ON)
+    return;
+  printf("\nPipeline: %llu instructions in %llu cycles, CPI %.3f\n",
+         INSTS, cycles, INSTS ? (double)cycles / INSTS : 0.0);
+  printf("  load-use stalls (ldrStallD)    : %12llu  %6.2f%%\n",
+         LDR_STALLS, cycles ? 100.0 * LDR_STALLS / cycles : 0.0);
+  printf("  branch mispredict (MispredictE): %12llu  %6.2f%%\n",
+         2 * MISPREDICTS, cycles ? 200.0 * MISPREDICTS / cycles : 0.0);
+  printf("  return mispredict (MispredictE): %12llu  %6.2f%%\n",
+         2 * RET_MISPREDICTS,
+         cycles ? 200.0 * RET_MISPREDICTS / cycles : 0.0);
+  printf("  PC write pending (PCWrPendingF): %12llu  %6.2f%%\n",
+         PC_STALLS, cycles ? 100.0 * PC_STALLS / cycles : 0.0);
+  printf("  PC write redirect (PCSrcW)     : %12llu  %6.2f%%\n",
+         PC_FLUSHES, cycles ? 100.0 * PC_FLUSHES / cycles : 0.0);
+  printf("  pipeline fill                  : %12d\n", INSTS ? 4 : 0);
+  if (PIPE_BTB)
+    printf("  branches: %llu, %llu mispredicted by the %d-entry BTB "
+           "(%.2f%% correct)\n", BRANCHES, MISPREDICTS, PIPE_BTB,
+           BRANCHES ? 100.0 * (BRANCHES - MISPREDICTS) / BRANCHES : 0.0);
+  else
+    printf("  branches: %llu, %llu taken (no BTB, predicted not taken)\n",
+           BRANCHES, MISPREDICTS);
+  printf("  returns: %llu, %llu mispredicted by the %d-entry RAS\n",
+         RETURNS, RET_MISPREDICTS, PIPE_RAS);
+  printf("  operands forwarded             : %llu from Memory, "
+         "%llu from Writeback\n", FWD_M, FWD_W);
+}
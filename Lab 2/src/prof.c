@@ -0,0 +1,373 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  Guest profiler (-profile). Every retired instruction bumps a counter
+  in a flat array parallel to the text region and the self count of
+  the current call-tree node. A taken BL moves to the child node for
+  its target; mov pc, lr, or any taken jump to the return address on
+  top of the shadow stack, moves back to the parent. At exit the flat
+  profile goes to stdout and the call tree is written in folded form
+  ("start;fib count") for flamegraph.pl.
+
+  Names come from the labels of the program's .s file next to the .x
+  (same name, .s suffix). Addresses are assigned the way the lab
+  programs are laid out: every instruction is 4 bytes from the start of
+  text, and the data directives below take their own size.
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shell.h"
+#include "sim.h"
+
+#define PROF_MAX_DEPTH 256
+
+typedef struct node_s {
+  uint32_t target;            /* entry pc of this frame */
+  unsigned long long self;
+  struct node_s *parent, *child, *next;
+} node_t;
+
+typedef struct {
+  uint32_t addr;
+  char *name;
+} sym_t;
+
+int PROFILE_ON = FALSE;
+
+static unsigned long long *COUNTS; /* per text word */
+static unsigned long long OUTSIDE; /* pcs outside text */
+static unsigned long long TOTAL;
+static node_t ROOT, *CUR = &ROOT;
+static uint32_t STACK[PROF_MAX_DEPTH];
+static int DEPTH, OVERFLOWS;
+static char *FOLDED_FILE;
+
+static sym_t *SYMS;
+static int NSYMS;
+
+/***************************************************************/
+/* Symbols from the .s source.                                 */
+/***************************************************************/
+
+static int sym_cmp (const void *a, const void *b) {
+
+  uint32_t x = ((const sym_t *)a)->addr, y = ((const sym_t *)b)->addr;
+  return x < y ? -1 : x > y;
+}
+
+static int count_items (const char *p) {
+
+  int n = 1;
+
+  for (; *p; p++)
+    n += *p == ',';
+  return n;
+}
+
+/* bytes emitted by one statement (label already removed) */
+static uint32_t statement_size (char *p, uint32_t addr) {
+
+  char op[16];
+  unsigned long arg;
+  int k;
+
+  if (*p == '\0')
+    return 0;
+  if (*p != '.')
+    return 4;
+  for (k = 0; k < 15 && p[k] && !isspace((unsigned char)p[k]); k++)
+    op[k] = tolower((unsigned char)p[k]);
+  op[k] = '\0';
+  p += k;
+  arg = strtoul(p, NULL, 0);
+
+  if (!strcmp(op, ".word") || !strcmp(op, ".long") || !strcmp(op, ".4byte"))
+    return 4 * count_items(p);
+  if (!strcmp(op, ".hword") || !strcmp(op, ".short") || !strcmp(op, ".2byte"))
+    return 2 * count_items(p);
+  if (!strcmp(op, ".byte"))
+    return count_items(p);
+  if (!strcmp(op, ".space") || !strcmp(op, ".skip"))
+    return arg;
+  if (!strcmp(op, ".align") || !strcmp(op, ".p2align"))
+    return ((addr + (1u << arg) - 1) & ~((1u << arg) - 1)) - addr;
+  if (!strcmp(op, ".balign") && arg)
+    return ((addr + arg - 1) / arg) * arg - addr;
+  return 0;
+}
+
+static void load_symbols (const char *program) {
+
+  char path[1024], line[512], *p, *colon, *dot;
+  uint32_t addr = TEXT_START;
+  int cap = 0, in_text = 1;
+  FILE *src;
+
+  snprintf(path, sizeof(path) - 2, "%s", program);
+  dot = strrchr(path, '.');
+  if (dot == NULL || strchr(dot, '/'))
+    dot = path + strlen(path);
+  strcpy(dot, ".s");
+  if ((src = fopen(path, "r")) == NULL)
+    return;
+
+  while (fgets(line, sizeof(line), src) != NULL) {
+    if ((p = strpbrk(line, "@;")) != NULL)
+      *p = '\0';
+    for (p = line; isspace((unsigned char)*p); p++);
+    /* any number of "label:" prefixes */
+    while ((colon = strchr(p, ':')) != NULL) {
+      char *q;
+      for (q = p; q < colon && (isalnum((unsigned char)*q) || *q == '_' ||
+                                *q == '.' || *q == '$'); q++);
+      if (q != colon || q == p)
+        break;
+      if (in_text) {
+        if (NSYMS == cap) {
+          cap = cap ? 2 * cap : 64;
+          SYMS = realloc(SYMS, cap * sizeof(sym_t));
+        }
+        SYMS[NSYMS].addr = addr;
+        SYMS[NSYMS++].name = strndup(p, colon - p);
+      }
+      for (p = colon + 1; isspace((unsigned char)*p); p++);
+    }
+    for (colon = p + strlen(p); colon > p && isspace((unsigned char)colon[-1]);)
+      *--colon = '\0';
+    if (!strncmp(p, ".text", 5))
+      in_text = 1;
+    else if (!strncmp(p, ".data", 5) || !strncmp(p, ".bss", 4))
+      in_text = 0;
+    else if (in_text)
+      addr += statement_size(p, addr);
+  }
+  fclose(src);
+  qsort(SYMS, NSYMS, sizeof(sym_t), sym_cmp);
+}
+
+/* Last symbol at or before pc, or NULL. */
+static sym_t *sym_lookup (uint32_t pc) {
+
+  int lo = 0, hi = NSYMS - 1, best = -1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (SYMS[mid].addr <= pc) {
+      best = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return best < 0 ? NULL : &SYMS[best];
+}
+
+static const char *frame_name (uint32_t pc, char *buf) {
+
+  sym_t *s = sym_lookup(pc);
+
+  if (s && s->addr == pc)
+    return s->name;
+  if (s)
+    sprintf(buf, "%s+0x%x", s->name, pc - s->addr);
+  else
+    sprintf(buf, "0x%08x", pc);
+  return buf;
+}
+
+/***************************************************************/
+/* Recording.                                                  */
+/***************************************************************/
+
+/*
+  mov pc, lr. Usually it lands on the top of the call stack, but a
+  return through an LR the program changed (or one that skips frames)
+  does not, so it is also recognised by its encoding.
+*/
+static int is_return (inst_t *d) {
+
+  return d->exec == data_process && d->cmd == 13 && d->Rd == 15 &&
+         !d->I && (d->Operand2 & 0xFFF) == 14;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : prof_commit                                     */
+/*                                                             */
+/* Purpose   : Count the instruction just retired from pc and  */
+/*             follow calls and returns                        */
+/*                                                             */
+/***************************************************************/
+void prof_commit (uint32_t pc, inst_t *d) {
+
+  uint32_t next = NEXT_STATE.PC, offset = pc - TEXT_START;
+  node_t *n;
+
+  TOTAL++;
+  CUR->self++;
+  if (offset < TEXT_SIZE)
+    COUNTS[offset >> 2]++;
+  else
+    OUTSIDE++;
+  if (next == pc + 4)
+    return;
+
+  if (d->exec == branch_process && ((d->word >> 24) & 0x1)) {
+    if (DEPTH == PROF_MAX_DEPTH) {
+      OVERFLOWS++;
+      return;
+    }
+    STACK[DEPTH++] = pc + 4;
+    for (n = CUR->child; n && n->target != next; n = n->next);
+    if (n == NULL) {
+      n = calloc(1, sizeof(node_t));
+      n->target = next;
+      n->parent = CUR;
+      n->next = CUR->child;
+      CUR->child = n;
+    }
+    CUR = n;
+  } else if (DEPTH && (next == STACK[DEPTH - 1] || is_return(d))) {
+    DEPTH--;
+    CUR = CUR->parent;
+  }
+}
+
+/***************************************************************/
+/* Reports.                                                    */
+/***************************************************************/
+
+static void write_folded (FILE *out, node_t *n, char *path, size_t len) {
+
+  char buf[64];
+  const char *name = frame_name(n->target, buf);
+  size_t add = strlen(name) + (len ? 1 : 0);
+
+  if (len + add < 4000) {
+    if (len)
+      path[len] = ';';
+    strcpy(path + len + (len ? 1 : 0), name);
+    len += add;
+  }
+  if (n->self)
+    fprintf(out, "%s %llu\n", path, n->self);
+  for (n = n->child; n; n = n->next)
+    write_folded(out, n, path, len);
+}
+
+typedef struct {
+  uint32_t pc;
+  unsigned long long count;
+} hot_t;
+
+static int hot_cmp (const void *a, const void *b) {
+
+  unsigned long long x = ((const hot_t *)a)->count, y = ((const hot_t *)b)->count;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : prof_report                                     */
+/*                                                             */
+/* Purpose   : Print the flat profile by symbol and by PC, and */
+/*             write the folded call stacks                    */
+/*                                                             */
+/***************************************************************/
+void prof_report () {
+
+  uint32_t k, nwords = TEXT_SIZE >> 2;
+  unsigned long long *per_sym;
+  hot_t *hot;
+  int i, nhot = 0;
+  char path[4096], buf[64];
+  FILE *out;
+
+  if (!PROFILE_ON)
+    return;
+  PROFILE_ON = FALSE;
+
+  printf("\nFlat profile: %llu instructions\n", TOTAL);
+  per_sym = calloc(NSYMS + 1, sizeof(unsigned long long));
+  hot = malloc(sizeof(hot_t) * 32);
+  for (k = 0; k < nwords; k++) {
+    sym_t *s;
+    if (COUNTS[k] == 0)
+      continue;
+    s = sym_lookup(TEXT_START + 4 * k);
+    per_sym[s ? s - SYMS : NSYMS] += COUNTS[k];
+    /* keep the 32 hottest, unsorted until the end */
+    if (nhot < 32) {
+      hot[nhot].pc = TEXT_START + 4 * k;
+      hot[nhot++].count = COUNTS[k];
+    } else {
+      int min = 0;
+      for (i = 1; i < 32; i++)
+        if (hot[i].count < hot[min].count)
+          min = i;
+      if (COUNTS[k] > hot[min].count) {
+        hot[min].pc = TEXT_START + 4 * k;
+        hot[min].count = COUNTS[k];
+      }
+    }
+  }
+
+  printf("      %%        count  symbol\n");
+  for (i = 0; i <= NSYMS; i++)
+    if (per_sym[i])
+      printf("  %6.2f %12llu  %s\n", 100.0 * per_sym[i] / TOTAL, per_sym[i],
+             i < NSYMS ? SYMS[i].name : "(no symbol)");
+  if (OUTSIDE)
+    printf("  %6.2f %12llu  (outside text)\n", 100.0 * OUTSIDE / TOTAL, OUTSIDE);
+
+  qsort(hot, nhot, sizeof(hot_t), hot_cmp);
+  printf("\nHottest instructions:\n");
+  printf("  address           %%        count  location\n");
+  for (i = 0; i < nhot; i++)
+    printf("  0x%08x  %6.2f %12llu  %s\n", hot[i].pc,
+           100.0 * hot[i].count / TOTAL, hot[i].count,
+           frame_name(hot[i].pc, buf));
+  if (OVERFLOWS)
+    printf("\nCall stack deeper than %d: %d calls not followed\n",
+           PROF_MAX_DEPTH, OVERFLOWS);
+
+  if ((out = fopen(FOLDED_FILE, "w")) == NULL) {
+    printf("Error: Can't open profile file %s\n", FOLDED_FILE);
+  } else {
+    path[0] = '\0';
+    write_folded(out, &ROOT, path, 0);
+    fclose(out);
+    printf("\nFolded call stacks written to %s\n", FOLDED_FILE);
+  }
+  free(per_sym);
+  free(hot);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : prof_open                                       */
+/*                                                             */
+/* Purpose   : Start profiling the loaded program. Call once   */
+/*             the entry PC is known.                          */
+/*                                                             */
+/***************************************************************/
+void prof_open (const char *folded_file, const char *program) {
+
+  COUNTS = calloc(TEXT_SIZE >> 2, sizeof(unsigned long long));
+  FOLDED_FILE = strdup(folded_file);
+  if (program != NULL)
+    load_symbols(program);
+  ROOT.target = CURRENT_STATE.PC;
+  PROFILE_ON = TRUE;
+}
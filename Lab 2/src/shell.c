@@ -13,51 +13,168 @@
 /* !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! */
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "shell.h"
+#include "sim.h"
+#include "cache.h"
+#include "jit.h"
 
 /***************************************************************/
 /* Main memory.                                                */
 /***************************************************************/
 
-#define MEM_DATA_START  0x10000000
-#define MEM_DATA_SIZE   0x00100000
-#define MEM_TEXT_START  0x00400000
-#define MEM_TEXT_SIZE   0x00100000
-#define MEM_STACK_START 0x7ff00000
-#define MEM_STACK_SIZE  0x00100000
-#define MEM_KDATA_START 0x90000000
-#define MEM_KDATA_SIZE  0x00100000
-#define MEM_KTEXT_START 0x80000000
-#define MEM_KTEXT_SIZE  0x00100000
+/* Memory map is in shell.h. */
 
-typedef struct {
-  uint32_t start, size;
-  uint8_t *mem;
-} mem_region_t;
-
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-  { MEM_TEXT_START, MEM_TEXT_SIZE, NULL },
-  { MEM_DATA_START, MEM_DATA_SIZE, NULL },
-  { MEM_STACK_START, MEM_STACK_SIZE, NULL },
-  { MEM_KDATA_START, MEM_KDATA_SIZE, NULL },
-  { MEM_KTEXT_START, MEM_KTEXT_SIZE, NULL }
+int USE_HUGE_PAGES = FALSE;
+
+/***************************************************************/
+/* Simulator context.                                          */
+/*                                                             */
+/* MAIN_CTX is the interactive shell's program. Its region     */
+/* table, adjusted by -mem/-memconfig, is the template for     */
+/* every context made by sim_ctx_create. Memory is mapped at   */
+/* initialization and committed on first touch.                */
+/***************************************************************/
+
+static sim_ctx MAIN_CTX = {
+  .regions = {
+    { "text",  MEM_TEXT_START,  MEM_TEXT_SIZE,  NULL },
+    { "data",  MEM_DATA_START,  MEM_DATA_SIZE,  NULL },
+    { "stack", MEM_STACK_START, MEM_STACK_SIZE, NULL },
+    { "kdata", MEM_KDATA_START, MEM_KDATA_SIZE, NULL },
+    { "ktext", MEM_KTEXT_START, MEM_KTEXT_SIZE, NULL }
+  },
+  .last_read_vpn = ~0u,
+  .last_write_vpn = ~0u
 };
 
-#define MEM_NREGIONS (sizeof(MEM_REGIONS)/sizeof(mem_region_t))
+__thread sim_ctx *SIM = &MAIN_CTX;
+
+int TRACE_LEVEL = TRACE_FULL;
+
+/***************************************************************/
+/* Guest page map.                                             */
+/*                                                             */
+/* Two-level table over the 32-bit guest space: the top 10     */
+/* bits pick a second-level table, the next 10 bits a 4 KB     */
+/* page, giving the host address of that page or NULL if no    */
+/* region covers it. A one-entry cache remembers the last page */
+/* used for reads and for writes.                              */
+/***************************************************************/
+
+#define PAGE_BITS 12
+#define PAGE_SIZE (1u << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define L1_BITS   10
+#define L2_BITS   10
+
+#define PAGE_MAP        (SIM->page_map)
+#define LAST_READ_VPN   (SIM->last_read_vpn)
+#define LAST_WRITE_VPN  (SIM->last_write_vpn)
+#define LAST_READ_PAGE  (SIM->last_read_page)
+#define LAST_WRITE_PAGE (SIM->last_write_page)
+
+/* guest words are stored little-endian in the region buffers */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LE32(x) __builtin_bswap32(x)
+#else
+#define LE32(x) (x)
+#endif
+
+static uint8_t *page_lookup (uint32_t vpn) {
+
+  uint8_t **l2 = PAGE_MAP[vpn >> L2_BITS];
+  return l2 ? l2[vpn & ((1 << L2_BITS) - 1)] : NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure: map_region                                       */
+/*                                                             */
+/* Purpose: Enter every page of a region into the page map     */
+/*                                                             */
+/***************************************************************/
+void map_region (uint32_t start, uint32_t size, uint8_t *mem) {
+
+  uint32_t off;
+
+  for (off = 0; off < size; off += PAGE_SIZE) {
+    uint32_t vpn = (start + off) >> PAGE_BITS;
+    uint8_t ***l2 = &PAGE_MAP[vpn >> L2_BITS];
+
+    if (*l2 == NULL)
+      *l2 = calloc(1 << L2_BITS, sizeof(uint8_t *));
+    (*l2)[vpn & ((1 << L2_BITS) - 1)] = mem + off;
+  }
+  LAST_READ_VPN = LAST_WRITE_VPN = ~0u;
+}
+
+/* Byte at a time, for words that straddle a page boundary. */
+static uint32_t mem_read_32_slow (uint32_t address) {
+
+  uint32_t value = 0;
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    uint8_t *page = page_lookup((address + k) >> PAGE_BITS);
+    if (page)
+      value |= page[(address + k) & PAGE_MASK] << (8 * k);
+  }
+  return value;
+}
+
+static void mem_write_32_slow (uint32_t address, uint32_t value) {
+
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    uint8_t *page = page_lookup((address + k) >> PAGE_BITS);
+    if (page)
+      page[(address + k) & PAGE_MASK] = (value >> (8 * k)) & 0xFF;
+  }
+}
 
 /***************************************************************/
-/* CPU State info.                                             */
+/*                                                             */
+/* Procedure: mem_peek_32                                      */
+/*                                                             */
+/* Purpose: Read a 32-bit word without the side effects of a   */
+/*          program load (commit trace, data cache); used for  */
+/*          instruction fetch and by the shell                 */
+/*                                                             */
 /***************************************************************/
+uint32_t mem_peek_32 (uint32_t address) {
+
+  uint32_t vpn = address >> PAGE_BITS;
+  uint32_t value;
+  uint8_t *page;
+
+  if (vpn == LAST_READ_VPN) {
+    page = LAST_READ_PAGE;
+  } else {
+    page = page_lookup(vpn);
+    if (page == NULL)
+      return 0;
+    LAST_READ_VPN = vpn;
+    LAST_READ_PAGE = page;
+  }
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_BIT;	/* run bit */
-int INSTRUCTION_COUNT;
+  if ((address & PAGE_MASK) > PAGE_SIZE - 4)
+    return mem_read_32_slow(address);
+  memcpy(&value, page + (address & PAGE_MASK), 4);
+  return LE32(value);
+}
 
 /***************************************************************/
 /*                                                             */
@@ -68,21 +185,13 @@ int INSTRUCTION_COUNT;
 /***************************************************************/
 uint32_t mem_read_32 (uint32_t address) {
 
-  int i;
-  for (i = 0; i < MEM_NREGIONS; i++) {
-    if (address >= MEM_REGIONS[i].start &&
-	address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-      uint32_t offset = address - MEM_REGIONS[i].start;
-
-      return
-	(MEM_REGIONS[i].mem[offset+3] << 24) |
-	(MEM_REGIONS[i].mem[offset+2] << 16) |
-	(MEM_REGIONS[i].mem[offset+1] <<  8) |
-	(MEM_REGIONS[i].mem[offset+0] <<  0);
-    }
-  }
+  uint32_t value = mem_peek_32(address);
 
-  return 0;
+  if (CTRACE_ON)
+    ctrace_mem(address, value, FALSE);
+  if (DCACHE)
+    cache_access(DCACHE, address, FALSE);
+  return value;
 }
 
 /***************************************************************/
@@ -94,19 +203,35 @@ uint32_t mem_read_32 (uint32_t address) {
 /***************************************************************/
 void mem_write_32 (uint32_t address, uint32_t value) {
 
-  int i;
-  for (i = 0; i < MEM_NREGIONS; i++) {
-    if (address >= MEM_REGIONS[i].start &&
-	address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-      uint32_t offset = address - MEM_REGIONS[i].start;
-
-      MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-      MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-      MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-      MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+  uint32_t vpn = address >> PAGE_BITS;
+  uint8_t *page;
+
+  if (CTRACE_ON)
+    ctrace_mem(address, value, TRUE);
+  if (DCACHE)
+    cache_access(DCACHE, address, TRUE);
+  if (vpn == LAST_WRITE_VPN) {
+    page = LAST_WRITE_PAGE;
+  } else {
+    page = page_lookup(vpn);
+    if (page == NULL)
       return;
-    }
+    LAST_WRITE_VPN = vpn;
+    LAST_WRITE_PAGE = page;
+  }
+  if (SIM->undo_on && SIM->undo_n < UNDO_MAX) {
+    SIM->undo_addr[SIM->undo_n] = address;
+    SIM->undo_old[SIM->undo_n++] = mem_peek_32(address);
   }
+
+  if ((address & PAGE_MASK) > PAGE_SIZE - 4) {
+    mem_write_32_slow(address, value);
+  } else {
+    value = LE32(value);
+    memcpy(page + (address & PAGE_MASK), &value, 4);
+  }
+  if (address - TEXT_START < TEXT_SIZE && !SPLIT_TEXT)
+    predecode_invalidate(address);
 }
 
 /***************************************************************/
@@ -124,6 +249,10 @@ void help () {
   printf("mdump low high        - dump memory from low to high  \n");
   printf("rdump                 - dump the register & bus value \n");
   printf("input reg_num reg_val - set GPR reg_num to reg_val    \n");
+  printf("trace level           - none, commit, decode or full  \n");
+  printf("cstats                - cache hit/miss counters       \n");
+  printf("save file             - checkpoint state and memory   \n");
+  printf("restore file          - resume from a checkpoint      \n");
   printf("?                     - display this help menu        \n");
   printf("quit                  - exit the program              \n\n");
 }
@@ -142,6 +271,62 @@ void cycle () {
   INSTRUCTION_COUNT++;
 }
 
+/***************************************************************/
+/*                                                             */
+/* Procedure : step_n                                          */
+/*                                                             */
+/* Purpose   : Execute up to n instructions on the current     */
+/*             engine without any output, stopping at halt.    */
+/*             Returns the number retired.                     */
+/*                                                             */
+/***************************************************************/
+int step_n (int n) {
+
+  int retired = 0;
+  long long start_count = INSTRUCTION_COUNT;
+
+  if (ENGINE != ENGINE_INTERP) {
+    while (RUN_BIT && retired < n) {
+      retired += run_threaded(n - retired);
+      INSTRUCTION_COUNT = start_count + retired;
+    }
+  } else {
+    while (RUN_BIT && retired < n) {
+      cycle();
+      retired++;
+    }
+  }
+  return retired;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : report_speed                                    */
+/*                                                             */
+/* Purpose   : Print simulated instructions per second for a   */
+/*             run that started at the given instruction count */
+/*             (and, once, that the JIT fell back to threaded) */
+/*                                                             */
+/***************************************************************/
+void report_speed (long long start_count, struct timespec *start) {
+
+  struct timespec stop;
+  double secs;
+  long long count = INSTRUCTION_COUNT - start_count;
+
+  static int jit_reported;
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  secs = (stop.tv_sec - start->tv_sec) + (stop.tv_nsec - start->tv_nsec) / 1e9;
+  if (secs > 0)
+    printf("Simulated %lld instructions in %.6f s (%.3f MIPS)\n\n",
+           count, secs, count / secs / 1e6);
+  if (ENGINE == ENGINE_JIT && SIM->jit_failed && !jit_reported) {
+    printf("JIT: cannot map code buffer, staying on threaded code\n\n");
+    jit_reported = TRUE;
+  }
+}
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : run n                                           */
@@ -152,6 +337,8 @@ void cycle () {
 void run (int num_cycles) {
 
   int i;
+  long long start_count = INSTRUCTION_COUNT;
+  struct timespec start;
 
   if (RUN_BIT == FALSE) {
     printf("Can't simulate, Simulator is halted\n\n");
@@ -159,13 +346,21 @@ void run (int num_cycles) {
   }
 
   printf("Simulating for %d cycles...\n\n", num_cycles);
-  for (i = 0; i < num_cycles; i++) {
-    if (RUN_BIT == FALSE) {
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (ENGINE != ENGINE_INTERP) {
+    INSTRUCTION_COUNT += run_threaded(num_cycles);
+    if (RUN_BIT == FALSE)
       printf("Simulator halted\n\n");
-      break;
+  } else {
+    for (i = 0; i < num_cycles; i++) {
+      if (RUN_BIT == FALSE) {
+        printf("Simulator halted\n\n");
+        break;
+      }
+      cycle();
     }
-    cycle();
   }
+  report_speed(start_count, &start);
 }
 
 /***************************************************************/
@@ -177,15 +372,24 @@ void run (int num_cycles) {
 /***************************************************************/
 void go () {
 
+  long long start_count = INSTRUCTION_COUNT;
+  struct timespec start;
+
   if (RUN_BIT == FALSE) {
     printf("Can't simulate, Simulator is halted\n\n");
     return;
   }
 
   printf("Simulating...\n\n");
-  while (RUN_BIT)
-    cycle();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (ENGINE != ENGINE_INTERP)
+    while (RUN_BIT)
+      INSTRUCTION_COUNT += run_threaded(INT_MAX);
+  else
+    while (RUN_BIT)
+      cycle();
   printf("Simulator halted\n\n");
+  report_speed(start_count, &start);
 }
 
 /***************************************************************/ 
@@ -204,7 +408,7 @@ void mdump (FILE * dumpsim_file, int start, int stop) {
   printf("-------------------------------------\n");
   for (address = start; address <= stop; address += 4)
     printf("  0x%08x (%d) :\t0x%08x\n", 
-	   address, address, mem_read_32(address));
+	   address, address, mem_peek_32(address));
   printf("\n");
 
   /* dump the memory contents into the dumpsim file */
@@ -212,7 +416,7 @@ void mdump (FILE * dumpsim_file, int start, int stop) {
   fprintf(dumpsim_file, "-------------------------------------\n");
   for (address = start; address <= stop; address += 4)
     fprintf(dumpsim_file, "  0x%08x (%d) :\t0x%08x\n", 
-	    address, address, mem_read_32(address));
+	    address, address, mem_peek_32(address));
   fprintf(dumpsim_file, "\n");
 }
 
@@ -230,26 +434,273 @@ void rdump (FILE * dumpsim_file) {
 
   printf("\nCurrent register/bus values :\n");
   printf("-------------------------------------\n");
-  printf("Instruction Count : %u\n", INSTRUCTION_COUNT);
+  printf("Instruction Count : %lld\n", INSTRUCTION_COUNT);
   printf("Registers:\n");
   for (k = 0; k < ARM_REGS-1; k++)
     printf("R%d:\t0x%08x\n", k, CURRENT_STATE.REGS[k]);
   printf("PC:\t0x%08x\n", CURRENT_STATE.PC);
   printf("CPSR:\t0x%08x\n", CURRENT_STATE.CPSR);
+  printf("Predecode hits    : %llu / %llu (%.2f%%)\n",
+         PREDECODE_HITS, PREDECODE_HITS + PREDECODE_MISSES,
+         predecode_hit_rate());
   printf("\n");
 
   /* dump the state information into the dumpsim file */
   fprintf(dumpsim_file, "\nCurrent register/bus values :\n");
   fprintf(dumpsim_file, "-------------------------------------\n");
-  fprintf(dumpsim_file, "Instruction Count : %u\n", INSTRUCTION_COUNT);
+  fprintf(dumpsim_file, "Instruction Count : %lld\n", INSTRUCTION_COUNT);
   fprintf(dumpsim_file, "Registers:\n");
   for (k = 0; k < ARM_REGS-1; k++)
     fprintf(dumpsim_file, "R%d: 0x%08x\n", k, CURRENT_STATE.REGS[k]);
   fprintf(dumpsim_file, "PC                : 0x%08x\n", CURRENT_STATE.PC);
   fprintf(dumpsim_file, "CPSR              : 0x%08x\n", CURRENT_STATE.CPSR);
+  fprintf(dumpsim_file, "Predecode hits    : %llu / %llu (%.2f%%)\n",
+          PREDECODE_HITS, PREDECODE_HITS + PREDECODE_MISSES,
+          predecode_hit_rate());
   fprintf(dumpsim_file, "\n");
 }
 
+/***************************************************************/
+/*                                                             */
+/* Procedure : parse_trace_level                               */
+/*                                                             */
+/* Purpose   : Map a trace level name or number to TRACE_*,    */
+/*             -1 if it is not one                             */
+/*                                                             */
+/***************************************************************/
+int parse_trace_level (char *name) {
+
+  static const char *names[] = { "none", "commit", "decode", "full" };
+  int i;
+
+  for (i = 0; i <= TRACE_FULL; i++)
+    if (!strcmp(name, names[i]) || (name[0] == '0' + i && name[1] == '\0'))
+      return i;
+  return -1;
+}
+
+/***************************************************************/
+/* Checkpoints.                                                */
+/*                                                             */
+/* File layout (host byte order):                              */
+/*   ckpt_header_t                                             */
+/*   ckpt_region_t       x nregions                            */
+/*   uint32_t guest page address x npages                      */
+/*   zero padding to a 4 KB boundary                           */
+/*   4 KB page data      x npages, in index order              */
+/* Pages that are all zero are not stored. Page data is page   */
+/* aligned in the file so a restore can mmap it in place.      */
+/***************************************************************/
+
+#define CKPT_MAGIC   "ARMCKPT"
+#define CKPT_VERSION 2
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t nregions;
+  uint32_t npages;
+  int32_t run_bit;
+  int64_t instruction_count;
+  CPU_State current, next;
+} ckpt_header_t;
+
+typedef struct {
+  char name[8];
+  uint32_t start, size;
+} ckpt_region_t;
+
+void init_memory();
+
+static int page_is_zero (const uint8_t *p) {
+
+  static const uint8_t zero[PAGE_SIZE];
+  return !memcmp(p, zero, PAGE_SIZE);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : save_checkpoint                                 */
+/*                                                             */
+/* Purpose   : Write CPU state, counters and every non-zero    */
+/*             page of every region to a file                  */
+/*                                                             */
+/***************************************************************/
+void save_checkpoint (char *filename) {
+
+  FILE *ck;
+  ckpt_header_t hdr;
+  ckpt_region_t reg;
+  uint32_t *index = NULL, cap = 0, n = 0, off;
+  long data_start, bytes;
+  int i, fd;
+  char tmp[PATH_MAX];
+
+  /* every page is compared: one that is not resident may still hold
+     data (swapped out, or mapped from an earlier checkpoint file), and
+     reading an untouched page only maps the shared zero page */
+  for (i = 0; i < MEM_NREGIONS; i++)
+    for (off = 0; off < MEM_REGIONS[i].size; off += PAGE_SIZE) {
+      if (page_is_zero(MEM_REGIONS[i].mem + off))
+        continue;
+      if (n == cap) {
+        cap = cap ? 2 * cap : 256;
+        index = realloc(index, cap * sizeof(uint32_t));
+      }
+      index[n++] = MEM_REGIONS[i].start + off;
+    }
+
+  /* written beside the target and renamed over it: a checkpoint
+     restored earlier may still be mapped as guest pages, and
+     truncating that file in place would fault them */
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", filename);
+  if ((fd = mkstemp(tmp)) < 0 || (ck = fdopen(fd, "wb")) == NULL) {
+    printf("Error: Can't open checkpoint file %s\n", filename);
+    if (fd >= 0) {
+      close(fd);
+      unlink(tmp);
+    }
+    free(index);
+    return;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC));
+  hdr.version = CKPT_VERSION;
+  hdr.nregions = MEM_NREGIONS;
+  hdr.npages = n;
+  hdr.instruction_count = INSTRUCTION_COUNT;
+  hdr.run_bit = RUN_BIT;
+  hdr.current = CURRENT_STATE;
+  hdr.next = NEXT_STATE;
+  fwrite(&hdr, sizeof(hdr), 1, ck);
+
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    memset(&reg, 0, sizeof(reg));
+    strncpy(reg.name, MEM_REGIONS[i].name, sizeof(reg.name) - 1);
+    reg.start = MEM_REGIONS[i].start;
+    reg.size = MEM_REGIONS[i].size;
+    fwrite(&reg, sizeof(reg), 1, ck);
+  }
+  fwrite(index, sizeof(uint32_t), n, ck);
+
+  data_start = (ftell(ck) + PAGE_MASK) & ~(long)PAGE_MASK;
+  fseek(ck, data_start, SEEK_SET);
+  for (off = 0; off < n; off++)
+    fwrite(page_lookup(index[off] >> PAGE_BITS), PAGE_SIZE, 1, ck);
+
+  bytes = ftell(ck);
+  if (ferror(ck) | fclose(ck) || rename(tmp, filename) < 0) {
+    printf("Error: Can't write checkpoint file %s\n", filename);
+    unlink(tmp);
+  } else {
+    printf("Saved %u non-zero pages to %s (%ld bytes)\n\n",
+           n, filename, bytes);
+  }
+  free(index);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : restore_checkpoint                              */
+/*                                                             */
+/* Purpose   : Load a checkpoint. At startup the region layout */
+/*             comes from the file and memory is set up here;  */
+/*             later the layout must match the running one.    */
+/*             Stored pages are mapped copy-on-write straight  */
+/*             from the file. Returns 0 on success.            */
+/*                                                             */
+/***************************************************************/
+int restore_checkpoint (char *filename, int at_startup) {
+
+  int fd, i;
+  struct stat st;
+  uint8_t *img;
+  ckpt_header_t hdr;
+  ckpt_region_t *regs;
+  uint32_t *index, k;
+  size_t data_start;
+
+  if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    printf("Error: Can't open checkpoint file %s\n", filename);
+    return -1;
+  }
+  img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (img == MAP_FAILED || (size_t)st.st_size < sizeof(hdr)) {
+    printf("Error: Can't map checkpoint file %s\n", filename);
+    close(fd);
+    return -1;
+  }
+  memcpy(&hdr, img, sizeof(hdr));
+  regs = (ckpt_region_t *)(img + sizeof(hdr));
+  index = (uint32_t *)(regs + hdr.nregions);
+  data_start = ((uint8_t *)(index + hdr.npages) - img + PAGE_MASK) & ~(size_t)PAGE_MASK;
+
+  if (memcmp(hdr.magic, CKPT_MAGIC, sizeof(CKPT_MAGIC)) ||
+      hdr.version != CKPT_VERSION || hdr.nregions != MEM_NREGIONS ||
+      data_start + (size_t)hdr.npages * PAGE_SIZE > (size_t)st.st_size) {
+    printf("Error: %s is not a valid checkpoint\n", filename);
+    munmap(img, st.st_size);
+    close(fd);
+    return -1;
+  }
+
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    if (at_startup) {
+      MEM_REGIONS[i].start = regs[i].start;
+      MEM_REGIONS[i].size = regs[i].size;
+    } else if (MEM_REGIONS[i].start != regs[i].start ||
+               MEM_REGIONS[i].size != regs[i].size) {
+      printf("Error: checkpoint memory layout differs (%s)\n",
+             MEM_REGIONS[i].name);
+      munmap(img, st.st_size);
+      close(fd);
+      return -1;
+    }
+  }
+
+  if (at_startup) {
+    init_memory();
+  } else {
+    /* drop current contents: fresh zero pages at the same addresses */
+    for (i = 0; i < MEM_NREGIONS; i++)
+      if (mmap(MEM_REGIONS[i].mem, MEM_REGIONS[i].size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+               -1, 0) == MAP_FAILED) {
+        printf("Error: Can't clear %s for the checkpoint, memory is now"
+               " undefined\n", MEM_REGIONS[i].name);
+        munmap(img, st.st_size);
+        close(fd);
+        return -1;
+      }
+  }
+
+  for (k = 0; k < hdr.npages; k++) {
+    uint8_t *page = page_lookup(index[k] >> PAGE_BITS);
+    off_t file_off = data_start + (off_t)k * PAGE_SIZE;
+
+    if (page == NULL)
+      continue;
+    /* copy-on-write file mapping; plain copy if the host page differs */
+    if (sysconf(_SC_PAGESIZE) != PAGE_SIZE ||
+        mmap(page, PAGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, file_off) == MAP_FAILED)
+      memcpy(page, img + file_off, PAGE_SIZE);
+  }
+
+  CURRENT_STATE = hdr.current;
+  NEXT_STATE = hdr.next;
+  INSTRUCTION_COUNT = hdr.instruction_count;
+  RUN_BIT = hdr.run_bit;
+  predecode_flush();
+
+  printf("Restored %u pages from %s at PC 0x%08x\n\n",
+         hdr.npages, filename, CURRENT_STATE.PC);
+  munmap(img, st.st_size);
+  close(fd);
+  return 0;
+}
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : get_command                                     */
@@ -259,7 +710,7 @@ void rdump (FILE * dumpsim_file) {
 /***************************************************************/
 void get_command (FILE * dumpsim_file) {
 
-  char buffer[20];
+  char buffer[20], level[20], filename[256];
   int start, stop, cycles;
   int register_no, register_value;
 
@@ -295,7 +746,10 @@ void get_command (FILE * dumpsim_file) {
 
   case 'R':
   case 'r':
-    if (buffer[1] == 'd' || buffer[1] == 'D')
+    if (!strcmp(buffer, "restore")) {
+      if (scanf("%255s", filename) == 1)
+        restore_checkpoint(filename, FALSE);
+    } else if (buffer[1] == 'd' || buffer[1] == 'D')
       rdump(dumpsim_file);
     else {
       if (scanf("%d", &cycles) != 1) break;
@@ -310,26 +764,206 @@ void get_command (FILE * dumpsim_file) {
     CURRENT_STATE.REGS[register_no] = register_value;
     NEXT_STATE.REGS[register_no] = register_value;
     break;
+
+  case 'C':
+  case 'c':
+    cache_report(stdout);
+    cache_report(dumpsim_file);
+    break;
+
+  case 'S':
+  case 's':
+    if (scanf("%255s", filename) == 1)
+      save_checkpoint(filename);
+    break;
+
+  case 'T':
+  case 't':
+    if (scanf("%19s", level) != 1)
+      break;
+    if (parse_trace_level(level) < 0)
+      printf("Unknown trace level %s\n", level);
+    else
+      TRACE_LEVEL = parse_trace_level(level);
+    break;
   default:
     printf("Invalid Command\n");
     break;
   }
 }
 
+/***************************************************************/
+/*                                                             */
+/* Procedure : set_region                                      */
+/*                                                             */
+/* Purpose   : Override one region's base and size by name.    */
+/*             Returns 0 on success, -1 on a bad name or a     */
+/*             base/size that is not 4 KB aligned.             */
+/*                                                             */
+/***************************************************************/
+int set_region (const char *name, const char *start, const char *size) {
+
+  unsigned long s = strtoul(start, NULL, 0), z = strtoul(size, NULL, 0);
+  int i;
+
+  if ((s & PAGE_MASK) || (z & PAGE_MASK) || z == 0 || s + z - 1 > 0xFFFFFFFFul)
+    return -1;
+  for (i = 0; i < MEM_NREGIONS; i++)
+    if (!strcmp(name, MEM_REGIONS[i].name)) {
+      MEM_REGIONS[i].start = s;
+      MEM_REGIONS[i].size = z;
+      return 0;
+    }
+  return -1;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : load_memory_config                              */
+/*                                                             */
+/* Purpose   : Read "name start size" lines ('#' comments)     */
+/*             and apply them with set_region                  */
+/*                                                             */
+/***************************************************************/
+void load_memory_config (char *filename) {
+
+  FILE *cfg;
+  char line[128], name[32], start[32], size[32];
+  int lineno = 0;
+
+  if ((cfg = fopen(filename, "r")) == NULL) {
+    printf("Error: Can't open memory config %s\n", filename);
+    exit(-1);
+  }
+  while (fgets(line, sizeof(line), cfg) != NULL) {
+    lineno++;
+    if (line[strspn(line, " \t\r\n")] == '#' ||
+        line[strspn(line, " \t\r\n")] == '\0')
+      continue;
+    if (sscanf(line, "%31s %31s %31s", name, start, size) != 3 ||
+        set_region(name, start, size) < 0) {
+      printf("Error: %s:%d: bad region line\n", filename, lineno);
+      exit(-1);
+    }
+  }
+  fclose(cfg);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : map_memory                                      */
+/*                                                             */
+/* Purpose   : Reserve memory. Pages are anonymous mmap, so    */
+/*             they read as zero and only take up RSS once     */
+/*             the program touches them. Data may sit exactly  */
+/*             over text (SPLIT_TEXT); it is mapped after it,  */
+/*             so loads and stores see data. Returns -1 with   */
+/*             the reason in error if the layout is bad or a   */
+/*             region can't be mapped.                         */
+/*                                                             */
+/***************************************************************/
+int map_memory (char *error, size_t len) {
+
+  int i, j;
+
+  for (i = 0; i < MEM_NREGIONS; i++)
+    for (j = 0; j < i; j++)
+      if (!(i == REGION_DATA && j == REGION_TEXT && SPLIT_TEXT) &&
+          MEM_REGIONS[i].start < MEM_REGIONS[j].start + MEM_REGIONS[j].size &&
+          MEM_REGIONS[j].start < MEM_REGIONS[i].start + MEM_REGIONS[i].size) {
+        snprintf(error, len, "memory regions %s and %s overlap",
+                 MEM_REGIONS[j].name, MEM_REGIONS[i].name);
+        return -1;
+      }
+
+  for (i = 0; i < MEM_NREGIONS; i++) {
+    MEM_REGIONS[i].mem = mmap(NULL, MEM_REGIONS[i].size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                              -1, 0);
+    if (MEM_REGIONS[i].mem == MAP_FAILED) {
+      /* sim_ctx_destroy unmaps the regions already mapped */
+      MEM_REGIONS[i].mem = NULL;
+      snprintf(error, len, "Can't map %u bytes for %s",
+               MEM_REGIONS[i].size, MEM_REGIONS[i].name);
+      return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    if (USE_HUGE_PAGES)
+      madvise(MEM_REGIONS[i].mem, MEM_REGIONS[i].size, MADV_HUGEPAGE);
+#endif
+    map_region(MEM_REGIONS[i].start, MEM_REGIONS[i].size,
+               MEM_REGIONS[i].mem);
+  }
+  return 0;
+}
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : init_memory                                     */
 /*                                                             */
-/* Purpose   : Allocate and zero memory                        */
+/* Purpose   : map_memory for the shell: report and exit on    */
+/*             failure                                         */
 /*                                                             */
 /***************************************************************/
 void init_memory () {
 
+  char error[128];
+
+  if (map_memory(error, sizeof(error)) < 0) {
+    printf("Error: %s\n", error);
+    exit(-1);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sim_ctx_create                                  */
+/*                                                             */
+/* Purpose   : Make a context with MAIN_CTX's memory layout.   */
+/*             Memory is not mapped until init_memory runs     */
+/*             with the context selected.                      */
+/*                                                             */
+/***************************************************************/
+sim_ctx *sim_ctx_create () {
+
+  sim_ctx *ctx = calloc(1, sizeof(sim_ctx));
   int i;
+
+  if (ctx == NULL)
+    return NULL;
   for (i = 0; i < MEM_NREGIONS; i++) {
-    MEM_REGIONS[i].mem = malloc(MEM_REGIONS[i].size);
-    memset(MEM_REGIONS[i].mem, 0, MEM_REGIONS[i].size);
+    ctx->regions[i] = MAIN_CTX.regions[i];
+    ctx->regions[i].mem = NULL;
   }
+  ctx->last_read_vpn = ctx->last_write_vpn = ~0u;
+  return ctx;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sim_ctx_destroy                                 */
+/*                                                             */
+/* Purpose   : Release a context's memory, page map, predecode */
+/*             table and blocks                                */
+/*                                                             */
+/***************************************************************/
+void sim_ctx_destroy (sim_ctx *ctx) {
+
+  sim_ctx *prev = SIM;
+  int i;
+
+  SIM = ctx;
+  predecode_release();
+  jit_release();
+  SIM = prev;
+  for (i = 0; i < MEM_NREGIONS; i++)
+    if (ctx->regions[i].mem != NULL)
+      munmap(ctx->regions[i].mem, ctx->regions[i].size);
+  for (i = 0; i < 1 << L1_BITS; i++)
+    free(ctx->page_map[i]);
+  if (ctx != &MAIN_CTX)
+    free(ctx);
 }
 
 /**************************************************************/
@@ -341,27 +975,14 @@ void init_memory () {
 /**************************************************************/
 void load_program (char *program_filename) {
 
-  FILE * prog;
-  int ii, word;
+  char error[256];
+  int words = read_program(program_filename, error, sizeof(error));
 
-  /* Open program file. */
-  prog = fopen(program_filename, "r");
-  if (prog == NULL) {
-    printf("Error: Can't open program file %s\n", program_filename);
+  if (words < 0) {
+    printf("Error: %s\n", error);
     exit(-1);
   }
-
-  /* Read in the program. */
-
-  ii = 0;
-  while (fscanf(prog, "%x\n", &word) != EOF) {
-    mem_write_32(MEM_TEXT_START + ii, word);
-    ii += 4;
-  }
-
-  CURRENT_STATE.PC = MEM_TEXT_START;
-
-  printf("Read %d words from program into memory.\n\n", ii/4);
+  printf("Read %d words from program into memory.\n\n", words);
 }
 
 /************************************************************/
@@ -385,25 +1006,278 @@ void initialize (char *program_filename, int num_prog_files) {
   RUN_BIT = TRUE;
 }
 
+/***************************************************************/
+/* Batch mode.                                                 */
+/*                                                             */
+/* Every program file is a separate job with its own sim_ctx.  */
+/* Workers take the next job index off a shared counter, run   */
+/* it to halt (or the instruction limit) and keep the final    */
+/* state; results are printed in command-line order once all   */
+/* workers are done, so output does not depend on scheduling.  */
+/***************************************************************/
+
+typedef struct {
+  char *file;
+  int words;          /* -1 if the file could not be read */
+  char error[256];    /* and why */
+  long long count;
+  int halted;
+  CPU_State state;
+} batch_job_t;
+
+static batch_job_t *BATCH_JOBS;
+static int BATCH_NJOBS, BATCH_NEXT, BATCH_LIMIT = INT_MAX;
+
+static void *batch_worker (void *arg) {
+
+  int j;
+
+  while ((j = __sync_fetch_and_add(&BATCH_NEXT, 1)) < BATCH_NJOBS) {
+    batch_job_t *job = &BATCH_JOBS[j];
+
+    SIM = sim_ctx_create();
+    init_memory();
+    job->words = read_program(job->file, job->error, sizeof(job->error));
+    NEXT_STATE = CURRENT_STATE;
+    RUN_BIT = job->words >= 0;
+    step_n(BATCH_LIMIT);
+    job->count = INSTRUCTION_COUNT;
+    job->halted = !RUN_BIT;
+    job->state = CURRENT_STATE;
+    sim_ctx_destroy(SIM);
+  }
+  return NULL;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_batch                                       */
+/*                                                             */
+/* Purpose   : Run each program file to completion on a pool   */
+/*             of worker threads and print the final registers */
+/*                                                             */
+/***************************************************************/
+int run_batch (char **files, int nfiles, int nthreads) {
+
+  pthread_t *workers;
+  struct timespec start, stop;
+  long long total = 0;
+  int i, k, failed = 0;
+  double secs;
+
+  BATCH_JOBS = calloc(nfiles, sizeof(batch_job_t));
+  BATCH_NJOBS = nfiles;
+  for (i = 0; i < nfiles; i++)
+    BATCH_JOBS[i].file = files[i];
+  if (nthreads <= 0)
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > nfiles)
+    nthreads = nfiles;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  workers = calloc(nthreads, sizeof(pthread_t));
+  for (i = 0; i < nthreads; i++)
+    pthread_create(&workers[i], NULL, batch_worker, NULL);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(workers[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  for (i = 0; i < nfiles; i++) {
+    batch_job_t *job = &BATCH_JOBS[i];
+
+    if (job->words < 0) {
+      printf("Error: %s\n\n", job->error);
+      failed++;
+      continue;
+    }
+    printf("%s: %lld instructions, %s\n", job->file, job->count,
+           job->halted ? "halted" : "stopped at instruction limit");
+    for (k = 0; k < ARM_REGS; k++)
+      printf("R%-2d 0x%08x%s", k, job->state.REGS[k],
+             (k & 3) == 3 ? "\n" : "  ");
+    printf("CPSR 0x%08x\n\n", job->state.CPSR);
+    failed += !job->halted;
+    total += job->count;
+  }
+
+  secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  printf("Batch: %d programs, %lld instructions in %.6f s on %d threads"
+         " (%.3f MIPS)\n", nfiles, total, secs, nthreads,
+         secs > 0 ? total / secs / 1e6 : 0.0);
+  free(workers);
+  free(BATCH_JOBS);
+  return failed ? 1 : 0;
+}
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : main                                            */
 /*                                                             */
 /***************************************************************/
+#ifndef ARMSIM_LIB
 int main (int argc, char *argv[]) {
 
   FILE * dumpsim_file;
+  int arg = 1;
+  char *restore_file = NULL;
+  int batch = FALSE, threads = 0;
+  char *ctrace_file = NULL, *profile_file = NULL;
+
+  /* Options */
+  while (arg < argc && argv[arg][0] == '-') {
+    if (!strcmp(argv[arg], "-engine") && arg + 1 < argc) {
+      if (!strcmp(argv[arg + 1], "threaded"))
+        ENGINE = ENGINE_THREADED;
+      else if (!strcmp(argv[arg + 1], "jit"))
+        ENGINE = ENGINE_JIT;
+      else if (!strcmp(argv[arg + 1], "interp"))
+        ENGINE = ENGINE_INTERP;
+      else {
+        printf("Error: unknown engine %s\n", argv[arg + 1]);
+        exit(1);
+      }
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-jit-threshold") && arg + 1 < argc) {
+      JIT_THRESHOLD = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-trace") && arg + 1 < argc) {
+      TRACE_LEVEL = parse_trace_level(argv[arg + 1]);
+      if (TRACE_LEVEL < 0) {
+        printf("Error: unknown trace level %s\n", argv[arg + 1]);
+        exit(1);
+      }
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-mem") && arg + 3 < argc) {
+      if (set_region(argv[arg + 1], argv[arg + 2], argv[arg + 3]) < 0) {
+        printf("Error: bad region %s %s %s\n",
+               argv[arg + 1], argv[arg + 2], argv[arg + 3]);
+        exit(1);
+      }
+      arg += 4;
+    } else if (!strcmp(argv[arg], "-memconfig") && arg + 1 < argc) {
+      load_memory_config(argv[arg + 1]);
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-restore") && arg + 1 < argc) {
+      restore_file = argv[arg + 1];
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-ctrace") && arg + 1 < argc) {
+      ctrace_file = argv[arg + 1];
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-profile") && arg + 1 < argc) {
+      profile_file = argv[arg + 1];
+      arg += 2;
+    } else if ((!strcmp(argv[arg], "-icache") ||
+                !strcmp(argv[arg], "-dcache")) && arg + 1 < argc) {
+      cache_t *c = cache_create(argv[arg] + 1, argv[arg + 1]);
+      if (c == NULL)
+        exit(1);
+      if (argv[arg][1] == 'i')
+        ICACHE = c;
+      else
+        DCACHE = c;
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-bpred") && arg + 1 < argc) {
+      if (bpred_add(argv[arg + 1]) < 0) {
+        printf("Error: bad predictor %s (taken, bimodal[:n], gshare[:n[:h]], "
+               "tournament[:n[:h]], btb[:n], all)\n", argv[arg + 1]);
+        exit(1);
+      }
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-pipeline")) {
+      PIPE_ON = TRUE;
+      arg++;
+    } else if ((!strcmp(argv[arg], "-pipeline-btb") ||
+                !strcmp(argv[arg], "-pipeline-ras")) && arg + 1 < argc) {
+      int n = atoi(argv[arg + 1]);
+      if (n < 0 || (n & (n - 1))) {
+        printf("Error: %s needs 0 or a power of two\n", argv[arg]);
+        exit(1);
+      }
+      if (argv[arg][10] == 'b')
+        PIPE_BTB = n;
+      else
+        PIPE_RAS = n;
+      PIPE_ON = TRUE;
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-batch")) {
+      batch = TRUE;
+      arg++;
+    } else if (!strcmp(argv[arg], "-threads") && arg + 1 < argc) {
+      threads = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-max") && arg + 1 < argc) {
+      BATCH_LIMIT = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (!strcmp(argv[arg], "-thp")) {
+      USE_HUGE_PAGES = TRUE;
+      arg++;
+    } else if (!strcmp(argv[arg], "-jit-check")) {
+      JIT_CHECK = TRUE;
+      arg++;
+    } else {
+      printf("Error: unknown option %s\n", argv[arg]);
+      exit(1);
+    }
+  }
 
   /* Error Checking */
-  if (argc < 2) {
-    printf("Error: usage: %s <program_file_1> <program_file_2> ...\n",
-           argv[0]);
+  if (arg >= argc && restore_file == NULL) {
+    printf("Error: usage: %s [-engine interp|threaded|jit] "
+           "[-jit-threshold n] [-jit-check] [-trace level] "
+           "[-mem name start size] [-memconfig file] [-thp] "
+           "[-ctrace file] [-profile file] [-icache spec] [-dcache spec] "
+           "[-bpred spec] [-pipeline] [-pipeline-btb n] [-pipeline-ras n]\n"
+           "       <program_file_1> <program_file_2> ... | -restore file\n"
+           "       %s -batch [-threads n] [-max n] [-engine e] "
+           "<program_file> ...\n", argv[0], argv[0]);
     exit(1);
   }
 
+  if (batch) {
+    /* caches and predictors describe the interactive program only */
+    ICACHE = DCACHE = NULL;
+    BPRED_ON = PIPE_ON = FALSE;
+    TRACE_LEVEL = TRACE_NONE;
+    return run_batch(&argv[arg], argc - arg, threads);
+  }
+
   printf("ARMv4 Simulator\n\n");
 
-  initialize(argv[1], argc - 1);
+  if (restore_file != NULL) {
+    if (restore_checkpoint(restore_file, TRUE) < 0)
+      exit(-1);
+  } else
+    initialize(argv[arg], argc - arg);
+
+  CACHE_ON = ICACHE != NULL || DCACHE != NULL;
+  if (CACHE_ON)
+    ENGINE = ENGINE_INTERP;
+
+  if (BPRED_ON) {
+    ENGINE = ENGINE_INTERP;
+    atexit(bpred_report);
+  }
+
+  if (PIPE_ON) {
+    ENGINE = ENGINE_INTERP;
+    atexit(pipe_report);
+  }
+
+  if (profile_file != NULL) {
+    prof_open(profile_file, restore_file ? NULL : argv[arg]);
+    ENGINE = ENGINE_INTERP;
+    atexit(prof_report);
+  }
+
+  if (ctrace_file != NULL) {
+    if (ctrace_open(ctrace_file) < 0) {
+      printf("Error: Can't open commit trace file %s\n", ctrace_file);
+      exit(-1);
+    }
+    /* records come from process_instruction(), so interpret */
+    ENGINE = ENGINE_INTERP;
+    atexit(ctrace_close);
+  }
 
   if ( (dumpsim_file = fopen( "dumpsim", "w" )) == NULL ) {
     printf("Error: Can't open dumpsim file\n");
@@ -414,3 +1288,4 @@ int main (int argc, char *argv[]) {
     get_command(dumpsim_file);
     
 }
+#endif
@@ -16,10 +16,49 @@
 #define _SIM_SHELL_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define FALSE 0
 #define TRUE  1
 
+/***************************************************************/
+/* Main memory map. These are the defaults; -mem and -memconfig */
+/* override them at startup (see MEM_REGIONS in shell.c).      */
+/***************************************************************/
+
+#define MEM_DATA_START  0x10000000
+#define MEM_DATA_SIZE   0x00100000
+#define MEM_TEXT_START  0x00400000
+#define MEM_TEXT_SIZE   0x00100000
+#define MEM_STACK_START 0x7ff00000
+#define MEM_STACK_SIZE  0x00100000
+#define MEM_KDATA_START 0x90000000
+#define MEM_KDATA_SIZE  0x00100000
+#define MEM_KTEXT_START 0x80000000
+#define MEM_KTEXT_SIZE  0x00100000
+
+typedef struct {
+  const char *name;
+  uint32_t start, size;
+  uint8_t *mem;
+} mem_region_t;
+
+enum { REGION_TEXT, REGION_DATA, REGION_STACK, REGION_KDATA, REGION_KTEXT,
+       MEM_NREGIONS };
+
+/* text region as configured */
+#define TEXT_START (MEM_REGIONS[REGION_TEXT].start)
+#define TEXT_SIZE  (MEM_REGIONS[REGION_TEXT].size)
+
+/* data placed exactly over text: separate instruction and data
+   memories at the same addresses, like the Lab 4 imem and dmem.
+   Fetch reads the text buffer, loads and stores the data buffer. */
+#define SPLIT_TEXT (MEM_REGIONS[REGION_DATA].start == TEXT_START && \
+                    MEM_REGIONS[REGION_DATA].size == TEXT_SIZE)
+
+/* stores one -jit-check pass can log: two runs of a 64-op block */
+#define UNDO_MAX 128
+
 #define ARM_REGS 16
 #define PC REGS[15]
 
@@ -29,11 +68,105 @@ typedef struct CPU_State_Struct {
   uint32_t CPSR; /* current program status register */
 } CPU_State;
 
-extern CPU_State CURRENT_STATE, NEXT_STATE;
-extern int RUN_BIT;	/* run bit */
+/*
+  Everything that belongs to one simulated program. The simulator
+  works on the context SIM points to, which is per thread, so several
+  programs can run side by side in one process (-batch). The names
+  below keep isa.h and the rest of the simulator written against what
+  used to be plain globals.
+*/
+typedef struct sim_ctx {
+  CPU_State current, next;
+  int run_bit;
+  long long instruction_count;
+  mem_region_t regions[MEM_NREGIONS];
+
+  /* guest page map and last-page caches (shell.c) */
+  uint8_t **page_map[1 << 10];
+  uint32_t last_read_vpn, last_write_vpn;
+  uint8_t *last_read_page, *last_write_page;
+
+  /* predecoded text and threaded blocks (sim.c) */
+  struct inst_s *predecode;
+  struct tblock_s **blocks;
+  int blocks_stale;
+  unsigned long long predecode_hits, predecode_misses;
+
+  /* host code for this context's translated blocks (jit.c) */
+  uint8_t *jit_buf;
+  size_t jit_used;
+  int jit_failed;
+
+  /* stores logged while -jit-check reruns a block (sim.c), with the
+     word each one overwrote */
+  int undo_on, undo_n;
+  uint32_t undo_addr[UNDO_MAX], undo_old[UNDO_MAX];
+} sim_ctx;
+
+extern __thread sim_ctx *SIM;
+
+#define CURRENT_STATE     (SIM->current)
+#define NEXT_STATE        (SIM->next)
+#define RUN_BIT           (SIM->run_bit)	/* run bit */
+#define INSTRUCTION_COUNT (SIM->instruction_count)
+#define MEM_REGIONS       (SIM->regions)
+
+sim_ctx *sim_ctx_create ();
+void     sim_ctx_destroy (sim_ctx *ctx);
 
 uint32_t mem_read_32 (uint32_t address);
+uint32_t mem_peek_32 (uint32_t address);
 void     mem_write_32 (uint32_t address, uint32_t value);
 void process_instruction ();
+int  read_program (char *program_filename, char *error, size_t len);
+int  step_n (int n);
+
+/*
+  Trace verbosity, set with -trace on the command line or the trace
+  shell command. Builds with -DTRACE_MAX=TRACE_NONE drop every TRACE()
+  call at compile time.
+*/
+#define TRACE_NONE   0 /* nothing per instruction               */
+#define TRACE_COMMIT 1 /* PC, word and changed registers        */
+#define TRACE_DECODE 2 /* plus the decoded instruction name     */
+#define TRACE_FULL   3 /* plus binary dump and every field      */
+
+#ifndef TRACE_MAX
+#define TRACE_MAX TRACE_FULL
+#endif
+
+extern int TRACE_LEVEL;
+
+#define TRACE(level, ...)                                         \
+  do {                                                            \
+    if (TRACE_MAX >= (level) && TRACE_LEVEL >= (level))           \
+      printf(__VA_ARGS__);                                        \
+  } while (0)
+
+/* Execution engines, chosen at startup with -engine (sim.c). */
+#define ENGINE_INTERP   0
+#define ENGINE_THREADED 1
+#define ENGINE_JIT      2
+extern int ENGINE;
+extern int JIT_THRESHOLD; /* block entries before translation */
+extern int JIT_CHECK;     /* compare JIT against interpreter  */
+int run_threaded (int max_instructions);
+
+/* Binary commit trace (ctrace.c), interpreter only. */
+extern int CTRACE_ON;
+int  ctrace_open (const char *filename);
+void ctrace_close ();
+void ctrace_begin ();
+void ctrace_mem (uint32_t address, uint32_t data, int store);
+void ctrace_commit (const CPU_State *pre, const CPU_State *post,
+                    uint32_t word);
+
+/* Predecoded instruction cache over MEM_TEXT (sim.c). */
+#define PREDECODE_HITS   (SIM->predecode_hits)
+#define PREDECODE_MISSES (SIM->predecode_misses)
+void   predecode_invalidate (uint32_t address);
+void   predecode_flush ();
+void   predecode_release ();
+double predecode_hit_rate ();
 
 #endif
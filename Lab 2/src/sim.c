@@ -12,6 +12,9 @@
 #include <string.h>
 #include "shell.h"
 #include "isa.h"
+#include "sim.h"
+#include "jit.h"
+#include "cache.h"
 
 
 char *byte_to_binary12 (int x) {
@@ -53,24 +56,26 @@ char *byte_to_binary32(int x) {
   return b;
 }
 
-int bchar_to_int(char* rsa) {
-
-  int i = 0;
-  int result = 0;
-  int t = 0;
-  while(rsa[i] != '\0')i++;
-  while(i>0)
-    {
-      --i;
-      // printf("%d\n", (rsa[i]-'0')<<t);
-      result += (rsa[i] - '0')<<t;
-      t++;
-    }
-  return result;
-}
+typedef int (*data_fn)(int Rd, int Rn, int Operand2, int I, int S, int CC);
+typedef int (*mem_fn)(int Rd, int Rn, int Operand2, int I);
+
+/* Data processing handlers indexed by cmd. */
+static const data_fn DATA_TABLE[16] = {
+  AND, EOR, SUB, RSB, ADD, ADC, SBC, RSC,
+  TST, TEQ, CMP, CMN, ORR, MOV, BIC, MVN
+};
+
+static const char *DATA_NAME[16] = {
+  "AND", "EOR", "SUB", "RSB", "ADD", "ADC", "SBC", "RSC",
+  "TST", "TEQ", "CMP", "CMN", "ORR", "MOV", "BIC", "MVN"
+};
+
+/* Single data transfer handlers indexed by {B, L}. */
+static const mem_fn MEM_TABLE[4] = { STR, LDR, STRB, LDRB };
 
+static const char *MEM_NAME[4] = { "STR", "LDR", "STRB", "LDRB" };
 
-int data_process(char* i_) {
+int data_process(inst_t *d) {
 
   /*
     This function further decode and execute subset of data processing 
@@ -94,294 +99,84 @@ int data_process(char* i_) {
     1111 = MVN - Rd:= NOT Op2
   */
 
-  char d_opcode[5];
-  d_opcode[0] = i_[7]; 
-  d_opcode[1] = i_[8]; 
-  d_opcode[2] = i_[9]; 
-  d_opcode[3] = i_[10]; 
-  d_opcode[4] = '\0';
-  char d_cond[5];
-  d_cond[0] = i_[0]; 
-  d_cond[1] = i_[1]; 
-  d_cond[2] = i_[2]; 
-  d_cond[3] = i_[3]; 
-  d_cond[4] = '\0';
-  char rn[5]; rn[4] = '\0';
-  char rd[5]; rd[4] = '\0';
-  char operand2[13]; operand2[12] = '\0';
-  for(int i = 0; i < 4; i++) {
-    rn[i] = i_[12+i];
-    rd[i] = i_[16+i];
-  }
-  for(int i = 0; i < 12; i++) {
-    operand2[i] = i_[20+i];
-  }
-  int Rn = bchar_to_int(rn);
-  int Rd = bchar_to_int(rd);
-  int Operand2 = bchar_to_int(operand2);
-  int I = i_[6]-'0';
-  int S = i_[11]-'0';
-  int CC = bchar_to_int(d_cond);
-  printf("Opcode = %s\n Rn = %d\n Rd = %d\n Operand2 = %s\n I = %d\n S = %d\n COND = %s\n", d_opcode, Rn, Rd, byte_to_binary12(Operand2), I, S, byte_to_binary4(CC));
-  printf("\n");
-  
-  // use for LSL and LSR case
-  char shamt5[6]; char sh[3]; char rm[5];
-  if(!I) {
-    shamt5[5] = '\0'; sh[2] = '\0'; rm[4] = '\0';
-    for(int i = 0; i < 6; i++) {
-      if(i<2) 
-        sh[i] = operand2[i+5];
-      if(i<4)
-        rm[i] = operand2[i+8];
-      shamt5[i] = operand2[i];
-    }
-    printf("shamt5 = %s\n sh = %s\n Rm = %s\n", shamt5, sh, rm);
-  }
-int Rm = bchar_to_int(rm);
-  /* Example - use and replicate */
-  if(!strcmp(d_opcode,"0100")) {
-    printf("--- This is an ADD instruction. \n");
-    ADD(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }	
-
-  /* Add other data instructions here */ 
-  else if(!strcmp(d_opcode, "0000")) {
-    printf("--- This is an AND instruction. \n");
-    AND(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "0001")) {
-    printf("--- This is an EOR instruction. \n");
-    AND(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "0010")) {
-    printf("--- This is a SUB instruction. \n");
-    SUB(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "0011")) {
-    printf("--- This is an RSB instruction. \n");
-    RSB(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "0101")) {
-    printf("--- This is an ADC instruction. \n");
-    ADC(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "0110")) {
-    printf("--- This is an SBC instruction. \n");
-    SBC(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "0111")) {
-    printf("--- This is an RSC instruction. \n");
-    RSC(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-  
-  else if(!strcmp(d_opcode, "1000")) {
-    printf("--- This is a TST instruction. \n");
-    TST(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "1001")) {
-    printf("--- This is a TEQ instruction. \n");
-    TEQ(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "1010")) {
-    printf("--- This is a CMP instruction. \n");
-    CMP(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "1011")) {
-    printf("--- This is a CMN instruction. \n");
-    CMN(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "1100")) {
-    printf("--- This is an ORR instruction. \n");
-    ORR(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-  
-  // Takes care of LSL LSR ASR and ROR
-  else if(!strcmp(d_opcode, "1101")) {
-    printf("--- This is an MOV instruction. \n");
-      MOV(Rd, Rn, Operand2, I, S, CC);
-      return 0;
-  }
-
-  else if(!strcmp(d_opcode, "1110")) {
-    printf("--- This is a BIC instruction. \n");
-    BIC(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  else if(!strcmp(d_opcode, "1111")) {
-    printf("--- This is an MVN instruction. \n");
-    MVN(Rd, Rn, Operand2, I, S, CC);
-    return 0;
-  }
-
-  return 1;	
+  TRACE(TRACE_FULL, "Opcode = %s\n Rn = %d\n Rd = %d\n Operand2 = %s\n I = %d\n S = %d\n COND = %s\n",
+         byte_to_binary4(d->cmd), d->Rn, d->Rd, byte_to_binary12(d->Operand2),
+         d->I, d->S, byte_to_binary4(d->cond));
+  TRACE(TRACE_FULL, "\n");
+  TRACE(TRACE_DECODE, "--- This is an %s instruction. \n", DATA_NAME[d->cmd]);
+  if(d->pc)
+    return pc_process(d);
+  return DATA_TABLE[d->cmd](d->Rd, d->Rn, d->Operand2, d->I, d->S, d->cond);
 }
 
-int branch_process(char* i_) {
+int branch_process(inst_t *d) {
   
   /* This function execute branch instruction */
 
-  /* Add branch instructions here */ 
-  char d_cond[5];
-  d_cond[0] = i_[0];
-  d_cond[1] = i_[1];
-  d_cond[2] = i_[2];
-  d_cond[3] = i_[3];
-  d_cond[4] = '\0';
-  int L;
-  L = i_[7] - '0';
-  char imm24[25];
-  imm24[24] = '\0';
-  for(int i = 0; i < 24; i++) {
-    imm24[i] = i_[8+i];
-  }
-  int IM = bchar_to_int(imm24);
-  printf("Cond = %s\n 1L = 1%d\n imm24 = %s\n", d_cond, L, imm24);
+  int L = (d->word >> 24) & 0x1;
+  TRACE(TRACE_FULL, "Cond = %s\n 1L = 1%d\n imm24 = %06x\n",
+         byte_to_binary4(d->cond), L, d->imm24 & 0xFFFFFF);
   if(!L) {
-    printf("--- This is a Branch instruction. \n");
-    B(IM);
+    TRACE(TRACE_DECODE, "--- This is a Branch instruction. \n");
+    B(d->imm24);
   }
   else {
-    printf("--- This is a Branch with Link Instruction. \n");
-    BL(IM);
+    TRACE(TRACE_DECODE, "--- This is a Branch with Link Instruction. \n");
+    BL(d->imm24);
   }
   return 1;
 }
 
-int mul_process(char* i_) {
+int mul_process(inst_t *d) {
 
   /* This function execute multiply instruction */
 
   /* Add multiply instructions here */ 
-  char d_opcode[4]; 
-  d_opcode[1] = i_[8]; 
-  d_opcode[2] = i_[9]; 
-  d_opcode[3] = i_[10]; 
-  d_opcode[4] = '\0';
-  char d_cond[5];
-  d_cond[0] = i_[0]; 
-  d_cond[1] = i_[1]; 
-  d_cond[2] = i_[2]; 
-  d_cond[3] = i_[3]; 
-  d_cond[4] = '\0';
-  int S = i_[11] - '0';
-  char Rd[5]; Rd[4] = '\0';
-  char Ra[5]; Ra[4] = '\0';
-  char Rm[5]; Rm[4] = '\0';
-  char Rn[5]; Rn[4] = '\0';
-  for(int i = 0; i < 4; i++) {
-    Rd[i] = i_[12+i];
-    Ra[i] = i_[16+i];
-    Rm[i] = i_[20+i];
-    Rn[i] = i_[28+i];
-  }
-  printf("opcode = %s\n condition = %s\n Rd = %s\n Ra = %s\n Rm = %s\n Rn = %s\n", d_opcode, d_cond, Rd, Ra, Rm, Rn);
-  /* function passes */
-  // if(!strcmp(d_opcode, "000")) {
-  //   printf("--- This is a MUL instruction. \n");
-  //   MUL(Rd, Rn, Rm);
-  //   return 0;
-  // } else if(!strcmp(d_opcode, "001")) {
-  //   printf("--- This is an MLA instruction. \n");
-  //   MLA(Rd, Rn, Rm, Ra);
-  //   return 0;
-  // } else if(!strcmp(d_opcode, "100")){
-  //   printf("--- This is a UMULL instruction. \n");
-  //   UMULL(Rd, Rn, Rm, Ra);
-  //   return 0;
-  // } else if(!strcmp(d_opcode, "101")){
-  //   printf("--- This is a UMLAL instruction. \n");
-  //   UMLAL(Rd, Rn, Rm, Ra);
-  //   return 0;
-  // } else if(!strcmp(d_opcode, "110")){
-  //   SMULL(Rd, Rn, Rm, Ra);
-  //   return 0;
-  // } else if(!strcmp(d_opcode, "111")){
-  //   SMLAL(Rd, Rn, Rm, Ra);
-  //   return 0;
-  // } 
+  TRACE(TRACE_FULL, "opcode = %d\n condition = %s\n Rd = %d\n Ra = %d\n Rm = %d\n Rn = %d\n",
+         (d->word >> 21) & 0x7, byte_to_binary4(d->cond), d->Rn, d->Rd,
+         (d->word >> 8) & 0xF, d->word & 0xF);
   return 1;
 }
 
-int transfer_process(char* i_) {
+int transfer_process(inst_t *d) {
 
   /* This function execute memory instruction */ 
-  char d_cond[5];
-  d_cond[0] = i_[0];
-  d_cond[1] = i_[1];
-  d_cond[2] = i_[2];
-  d_cond[3] = i_[3];
-  d_cond[4] = '\0';
-  int I, P, U, B, W, L;
-  I = i_[6] - '0'; P = i_[7] - '0';
-  U = i_[8] - '0'; B = i_[9] - '0';
-  W = i_[10] - '0'; L = i_[11] - '0';
-  char rn[5]; char rd[5];
-  rn[4] = '\0'; rd[4] = '\0';
-  for(int i = 0; i < 4; i++) {
-    rn[i] = i_[12+i]; rd[i] = i_[16+i];
-  }
-  char src2[13];
-  src2[12] = '\0';
-  for(int i = 0; i < 12; i++) {
-    src2[i] = i_[20+i];
-  }
-  char shamt5[6]; char sh[3]; char rm[5];
-  printf("I = %d\n", I);
-  if(I) {
-    shamt5[5] = '\0'; sh[2] = '\0'; rm[4] = '\0';
-    for(int i = 0; i < 6; i++) {
-      if(i<2) 
-        sh[i] = src2[i+5];
-      if(i<4)
-        rm[i] = src2[i+8];
-      shamt5[i] = src2[i];
-    }
-    printf("shamt5 = %s\n sh = %s\n Rm = %s\n", shamt5, sh, rm);
-  } else {
-    printf("imm12 = %s\n", src2);
-  }
-  int imm12 = bchar_to_int(src2);
-  int RD = bchar_to_int(rd);
-  int RN = bchar_to_int(rn);
-  /* Add memory instructions here */ 
-  if(!B && !L)
-    STR(RD, RN, imm12, I);
-  else if(!B && L)
-    LDR(RD, RN, imm12, I);
-  else if(B && !L)
-    STRB(RD, RN, imm12, I);
-  else if(B && L)
-    LDRB(RD, RN, imm12, I);
-  return 1;
+  TRACE(TRACE_FULL, "I = %d\n", d->I);
+  if(d->I)
+    TRACE(TRACE_FULL, "shamt5 = %d\n sh = %d\n Rm = %d\n", (d->Operand2 >> 7) & 0x1F,
+           (d->Operand2 >> 5) & 0x3, d->Operand2 & 0xF);
+  else
+    TRACE(TRACE_FULL, "imm12 = %s\n", byte_to_binary12(d->Operand2));
+  TRACE(TRACE_DECODE, "--- This is a %s instruction. \n", MEM_NAME[(d->B << 1) | d->L]);
+  if(d->pc)
+    return pc_process(d);
+  return MEM_TABLE[(d->B << 1) | d->L](d->Rd, d->Rn, d->Operand2, d->I);
+
+}
 
+/*
+  R15 read as an operand is the instruction's address + 8, and a value
+  written to it is the next PC. The isa.h handlers see CURRENT_STATE.PC
+  and every instruction is followed by NEXT_STATE.PC += 4, so decode()
+  marks the instructions that use R15 and they run through here.
+*/
+int pc_process(inst_t *d) {
+
+  uint32_t pc = CURRENT_STATE.PC;
+  int r;
+
+  CURRENT_STATE.PC = pc + 8;
+  if(d->op == 0)
+    r = DATA_TABLE[d->cmd](d->Rd, d->Rn, d->Operand2, d->I, d->S, d->cond);
+  else
+    r = MEM_TABLE[(d->B << 1) | d->L](d->Rd, d->Rn, d->Operand2, d->I);
+  CURRENT_STATE.PC = pc;
+  if(ends_block(d))
+    NEXT_STATE.PC -= 4;
+  return r;
 }
 
-int interruption_process(char* i_) {
+int interruption_process(inst_t *d) {
 
   SWI();
   RUN_BIT = 0;
@@ -389,48 +184,157 @@ int interruption_process(char* i_) {
 
 }
 
-unsigned int COND(unsigned int i_word) {
+int unknown_process(inst_t *d) {
 
-  return (i_word>>28);
+  TRACE(TRACE_DECODE, "- Unknown instruction %08x. \n", d->word);
+  return 1;
 
 }
 
-unsigned int OPCODE(unsigned int i_word) {
-
-  return ((i_word<<7)>>27);
-
+void decode (uint32_t word, inst_t *d) {
+
+  d->word     = word;
+  d->cond     = (word >> 28) & 0xF;
+  d->op       = (word >> 26) & 0x3;
+  d->I        = (word >> 25) & 0x1;
+  d->cmd      = (word >> 21) & 0xF;
+  d->S        = (word >> 20) & 0x1;
+  d->Rn       = (word >> 16) & 0xF;
+  d->Rd       = (word >> 12) & 0xF;
+  d->Operand2 = word & 0xFFF;
+  d->P        = (word >> 24) & 0x1;
+  d->U        = (word >> 23) & 0x1;
+  d->B        = (word >> 22) & 0x1;
+  d->W        = (word >> 21) & 0x1;
+  d->L        = (word >> 20) & 0x1;
+  d->imm24    = ((int32_t)(word << 8)) >> 8;
+  d->rot      = 0;
+  d->imm      = 0;
+  d->exec     = unknown_process;
+  d->pc       = 0;
+
+  switch(d->op) {
+  case 0:
+    if((word & 0x0FC000F0) == 0x00000090) {
+      d->exec = mul_process;
+    } else {
+      d->exec = data_process;
+      d->pc   = d->Rn == 15 || d->Rd == 15 || (!d->I && (word & 0xF) == 15);
+      if(d->I) {
+        d->rot = (d->Operand2 >> 8) * 2;
+        d->imm = d->Operand2 & 0xFF;
+        if(d->rot)
+          d->imm = (d->imm >> d->rot) | (d->imm << (32 - d->rot));
+      }
+    }
+    break;
+  case 1:
+    d->exec = transfer_process;
+    d->imm  = d->Operand2;
+    d->pc   = d->Rn == 15 || d->Rd == 15 || (d->I && (word & 0xF) == 15);
+    break;
+  case 2:
+    d->exec = branch_process;
+    d->imm  = (uint32_t)d->imm24 << 2;
+    break;
+  default:
+    if(((word >> 24) & 0xF) == 0xF)
+      d->exec = interruption_process;
+  }
 }
 
-
-int decode_and_execute(char* i_) {
+int decode_and_execute(inst_t *d) {
 
   /* 
-     This function decode the instruction and update 
+     This function execute a decoded instruction and update 
      CPU_State (NEXT_STATE)
   */
 
-  if((i_[4] == '1') && (i_[5] == '0') && (i_[6] == '1')) {
-    printf("- This is a Branch Instruction. \n");
-    branch_process(i_);
-  }
-  if((i_[4] == '0') && (i_[5] == '0') && (i_[6] == '0') && (i_[7] == '0') && (i_[24] == '1') && (i_[25] == '0') && (i_[26] == '0') && (i_[27] == '1')) {
-    printf("- This is a Multiply Instruction. \n");
-    mul_process(i_);
-  }
-  else {
-    printf("- This is a Data Processing Instruction. \n");
-    data_process(i_);
-  }
-  if((i_[4] == '0') && (i_[5] == '1')) {
-    printf("- This is a Single Data Transfer Instruction. \n");
-    transfer_process(i_);
+  if(!check_cond(d->cond))
+    return 0;
+  return d->exec(d);
+
+}
+
+/*
+  Predecoded instruction cache. One entry per word of the text region,
+  indexed by (PC - TEXT_START) >> 2, filled on first fetch and invalidated
+  by mem_write_32() when a store lands in the text region.
+*/
+#define PREDECODE_ENTRIES (TEXT_SIZE >> 2)
+
+#define PREDECODE (SIM->predecode)
+
+/* set when text is written; the threaded engine drops its blocks */
+#define BLOCKS_STALE (SIM->blocks_stale)
+
+void predecode_invalidate (uint32_t address) {
+
+  uint32_t offset = address - TEXT_START;
+
+  if(PREDECODE == NULL)
+    return;
+  BLOCKS_STALE = 1;
+  PREDECODE[offset >> 2].valid = 0;
+  /* an unaligned store can straddle into the next word */
+  if((offset & 3) && (offset >> 2) + 1 < PREDECODE_ENTRIES)
+    PREDECODE[(offset >> 2) + 1].valid = 0;
+}
+
+void predecode_flush () {
+
+  /* whole text region replaced (checkpoint restore) */
+  free(PREDECODE);
+  PREDECODE = NULL;
+  BLOCKS_STALE = 1;
+}
+
+double predecode_hit_rate () {
+
+  unsigned long long total = PREDECODE_HITS + PREDECODE_MISSES;
+  return total ? 100.0 * PREDECODE_HITS / total : 0.0;
+}
+
+/* an aligned word of text, from the text buffer itself: with
+   SPLIT_TEXT the page map at these addresses holds data */
+static uint32_t text_word (uint32_t offset) {
+
+  const uint8_t *p = MEM_REGIONS[REGION_TEXT].mem + offset;
+
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inst_t *fetch_decoded (uint32_t pc, inst_t *scratch) {
+
+  uint32_t offset = pc - TEXT_START;
+  inst_t *d;
+
+  if(offset >= TEXT_SIZE || (offset & 3)) {
+    decode(mem_peek_32(pc), scratch);
+    return scratch;
   }
-  if((i_[4] == '1') && (i_[5] == '1') && (i_[6] == '1') && (i_[7] == '1')) {
-    printf("- This is a Software Interruption Instruction. \n");
-    interruption_process(i_);
+  if(PREDECODE == NULL)
+    PREDECODE = calloc(PREDECODE_ENTRIES, sizeof(inst_t));
+
+  d = &PREDECODE[offset >> 2];
+  if(d->valid) {
+    PREDECODE_HITS++;
+    return d;
   }
-  return 0;
+  PREDECODE_MISSES++;
+  decode(text_word(offset), d);
+  d->valid = 1;
+  return d;
+}
+
+/*
+  Conditional branches go to the branch predictors. Branches leave the
+  flags alone, so the condition can be checked after the step too.
+*/
+static void bpred_commit (uint32_t pc, inst_t *d) {
 
+  if(d->exec == branch_process && d->cond != 14)
+    bpred_update(pc, pc + 8 + ((uint32_t)d->imm24 << 2), check_cond(d->cond));
 }
 
 void process_instruction() {
@@ -441,15 +345,385 @@ void process_instruction() {
      access memory. 
   */   
 
-  unsigned int inst_word = mem_read_32(CURRENT_STATE.PC);
-  printf("The instruction is: %x \n", inst_word);
-  printf("33222222222211111111110000000000\n");
-  printf("10987654321098765432109876543210\n");
-  printf("--------------------------------\n");
-  printf("%s \n", byte_to_binary32(inst_word));
-  printf("\n");
-  decode_and_execute(byte_to_binary32(inst_word));
+  inst_t scratch;
+  uint32_t pc = CURRENT_STATE.PC;
+  inst_t *d = fetch_decoded(pc, &scratch);
+  uint32_t inst_word = d->word;
+  CPU_State pre;
+  int k;
+
+  if(ICACHE)
+    cache_access(ICACHE, pc, FALSE);
+  if(PIPE_ON)
+    pipe_issue(pc, inst_word, check_cond(d->cond));
+
+  if(CTRACE_ON) {
+    pre = CURRENT_STATE;
+    ctrace_begin();
+  }
+
+  /* untraced path: no formatting code at all */
+  if(TRACE_LEVEL == TRACE_NONE) {
+    step_decoded(d);
+    if(CTRACE_ON)
+      ctrace_commit(&pre, &NEXT_STATE, inst_word);
+    if(PROFILE_ON)
+      prof_commit(pc, d);
+    if(BPRED_ON)
+      bpred_commit(pc, d);
+    return;
+  }
+
+  TRACE(TRACE_FULL, "The instruction is: %x \n", inst_word);
+  TRACE(TRACE_FULL, "33222222222211111111110000000000\n");
+  TRACE(TRACE_FULL, "10987654321098765432109876543210\n");
+  TRACE(TRACE_FULL, "--------------------------------\n");
+  TRACE(TRACE_FULL, "%s \n", byte_to_binary32(inst_word));
+  TRACE(TRACE_FULL, "\n");
+  decode_and_execute(d);
+
+  /* one line per retired instruction plus the registers it changed */
+  TRACE(TRACE_COMMIT, "0x%08x: %08x", CURRENT_STATE.PC, inst_word);
+  for(k = 0; k < ARM_REGS - 1; k++)
+    if(NEXT_STATE.REGS[k] != CURRENT_STATE.REGS[k])
+      TRACE(TRACE_COMMIT, "  R%d=0x%08x", k, NEXT_STATE.REGS[k]);
+  if(NEXT_STATE.CPSR != CURRENT_STATE.CPSR)
+    TRACE(TRACE_COMMIT, "  CPSR=0x%08x", NEXT_STATE.CPSR);
+  TRACE(TRACE_COMMIT, "\n");
+
+  NEXT_STATE.PC += 4;
+  if(CTRACE_ON)
+    ctrace_commit(&pre, &NEXT_STATE, inst_word);
+  if(PROFILE_ON)
+    prof_commit(pc, d);
+  if(BPRED_ON)
+    bpred_commit(pc, d);
+
+}
+
+void step_decoded (inst_t *d) {
+
+  /*
+    Same as process_instruction() for an already decoded word, minus
+    the trace. Used by the JIT for instructions it does not translate.
+  */
+
+  CURRENT_STATE = NEXT_STATE;
+  if(check_cond(d->cond)) {
+    if(d->pc)
+      pc_process(d);
+    else if(d->exec == data_process)
+      DATA_TABLE[d->cmd](d->Rd, d->Rn, d->Operand2, d->I, d->S, d->cond);
+    else if(d->exec == transfer_process)
+      MEM_TABLE[(d->B << 1) | d->L](d->Rd, d->Rn, d->Operand2, d->I);
+    else if(d->exec == branch_process) {
+      if((d->word >> 24) & 0x1)
+        BL(d->imm24);
+      else
+        B(d->imm24);
+    } else if(d->exec == interruption_process) {
+      SWI();
+      RUN_BIT = 0;
+    }
+  }
+  NEXT_STATE.PC += 4;
+  CURRENT_STATE = NEXT_STATE;
+}
+
+int cond_passed (int cond) {
+
+  return check_cond(cond);
+}
+
+/*
+  Threaded-code engine (ENGINE_THREADED).
+
+  Each basic block of the text region is translated once into an array of
+  top_t, one per instruction, holding the address of the label that
+  executes it (GCC labels-as-values) and the predecoded record. A block
+  ends at a branch, SWI, unknown word or any data processing/load that
+  writes R15. Every label finishes its instruction with its own
+  indirect jump to the next one, so dispatch is spread across many
+  branch sites instead of one mispredicted switch. Semantics match
+  process_instruction(): the isa.h handlers read CURRENT_STATE and
+  write NEXT_STATE, then the PC is advanced and the state committed.
+  No per-instruction trace is printed in this engine.
+
+  With -engine jit the same loop counts block entries and hands a block
+  to jit_compile() once it has been entered JIT_THRESHOLD times.
+*/
+#define BLOCK_MAX 64
+
+typedef struct {
+  const void *label; /* entry: condition check or body   */
+  const void *body;  /* executes the instruction         */
+  inst_t *d;
+  union {
+    data_fn data;
+    mem_fn mem;
+  } fn;
+} top_t;
+
+typedef struct tblock_s {
+  int len;
+  int count;  /* entries, for promotion to the JIT tier */
+  jit_fn jit; /* host code once promoted, else NULL      */
+  top_t ops[BLOCK_MAX];
+} tblock_t;
+
+enum { T_COND, T_DATA, T_MEM, T_PC, T_B, T_BL, T_SWI, T_NOP, T_NLABELS };
+
+#define BLOCKS (SIM->blocks)
+
+int ENGINE = ENGINE_INTERP;
+int JIT_THRESHOLD = 50;
+int JIT_CHECK = FALSE;
+
+void flush_blocks () {
+
+  int i;
+  for(i = 0; i < PREDECODE_ENTRIES; i++) {
+    free(BLOCKS[i]);
+    BLOCKS[i] = NULL;
+  }
+  if(ENGINE == ENGINE_JIT)
+    jit_reset();
+  BLOCKS_STALE = 0;
+}
+
+/* free the current context's predecode table and blocks */
+void predecode_release () {
+
+  if(BLOCKS != NULL) {
+    flush_blocks();
+    free(BLOCKS);
+    BLOCKS = NULL;
+  }
+  predecode_flush();
+}
+
+int ends_block (inst_t *d) {
+
+  switch(d->op) {
+  case 0:
+    /* TST/TEQ/CMP/CMN do not write Rd */
+    return d->Rd == 15 && (d->cmd < 8 || d->cmd > 11);
+  case 1:
+    return d->L && d->Rd == 15;
+  default:
+    return 1;
+  }
+}
+
+tblock_t *translate_block (uint32_t pc, const void **labels) {
+
+  tblock_t *blk = malloc(sizeof(tblock_t));
+  inst_t scratch;
+  int n = 0;
+
+  while(n < BLOCK_MAX && pc - TEXT_START < TEXT_SIZE) {
+    inst_t *d = fetch_decoded(pc, &scratch);
+    top_t *op = &blk->ops[n++];
+
+    op->d = d;
+    op->body = labels[T_NOP];
+    if(d->exec == data_process) {
+      op->body = labels[T_DATA];
+      op->fn.data = DATA_TABLE[d->cmd];
+    } else if(d->exec == transfer_process) {
+      op->body = labels[T_MEM];
+      op->fn.mem = MEM_TABLE[(d->B << 1) | d->L];
+    } else if(d->exec == branch_process) {
+      op->body = labels[(d->word >> 24) & 0x1 ? T_BL : T_B];
+    } else if(d->exec == interruption_process) {
+      op->body = labels[T_SWI];
+    }
+    if(d->pc)
+      op->body = labels[T_PC];
+    op->label = (d->cond == 14) ? op->body : labels[T_COND];
+
+    if(ends_block(d))
+      break;
+    pc += 4;
+  }
+  blk->len = n;
+  blk->count = 0;
+  blk->jit = NULL;
+  return blk;
+}
+
+void promote_block (tblock_t *blk, uint32_t pc) {
+
+  inst_t *insts[BLOCK_MAX];
+  int i;
 
+  for(i = 0; i < blk->len; i++)
+    insts[i] = blk->ops[i].d;
+  blk->jit = jit_compile(pc, insts, blk->len);
+}
+
+/*
+  Differential mode (-jit-check): run the block through step_decoded()
+  first, then rewind the register state and run the host code, and
+  halt on the first block where the two disagree. Stores are logged
+  (mem_write_32) and undone before the host code runs, then every word
+  either pass stored is compared too.
+*/
+int check_block (tblock_t *blk) {
+
+  CPU_State cur = CURRENT_STATE, nxt = NEXT_STATE, ref_cur, ref_nxt;
+  uint32_t ref_mem[UNDO_MAX], want = 0, got = 0;
+  int run = RUN_BIT, ref_run, ref_n, bad = -1, i, j, k, n;
+
+  SIM->undo_n = 0;
+  SIM->undo_on = 1;
+  for(i = 0; i < blk->len; i++)
+    step_decoded(blk->ops[i].d);
+  ref_cur = CURRENT_STATE; ref_nxt = NEXT_STATE; ref_run = RUN_BIT;
+
+  /* keep what the reference stored, then put memory back */
+  SIM->undo_on = 0;
+  ref_n = SIM->undo_n;
+  for(k = 0; k < ref_n; k++)
+    ref_mem[k] = mem_peek_32(SIM->undo_addr[k]);
+  for(k = ref_n - 1; k >= 0; k--)
+    mem_write_32(SIM->undo_addr[k], SIM->undo_old[k]);
+
+  CURRENT_STATE = cur; NEXT_STATE = nxt; RUN_BIT = run;
+  SIM->undo_on = 1;
+  n = blk->jit();
+  SIM->undo_on = 0;
+
+  /* each word at its first logged store: the reference's final value,
+     or for a word only the host code stored, the value before */
+  for(k = 0; k < SIM->undo_n && bad < 0; k++) {
+    for(j = 0; j < k && SIM->undo_addr[j] != SIM->undo_addr[k]; j++)
+      ;
+    if(j < k)
+      continue;
+    want = k < ref_n ? ref_mem[k] : SIM->undo_old[k];
+    got = mem_peek_32(SIM->undo_addr[k]);
+    if(got != want)
+      bad = k;
+  }
+
+  if(memcmp(&ref_cur, &CURRENT_STATE, sizeof(CPU_State)) ||
+     memcmp(&ref_nxt, &NEXT_STATE, sizeof(CPU_State)) || ref_run != RUN_BIT ||
+     bad >= 0) {
+    printf("JIT mismatch in block at 0x%08x (%d instructions)\n",
+           cur.PC, blk->len);
+    printf("       interp      jit\n");
+    for(k = 0; k < ARM_REGS; k++)
+      printf("R%-3d   0x%08x  0x%08x%s\n", k, ref_cur.REGS[k],
+             CURRENT_STATE.REGS[k],
+             ref_cur.REGS[k] != CURRENT_STATE.REGS[k] ? "  <--" : "");
+    printf("CPSR   0x%08x  0x%08x%s\n", ref_cur.CPSR, CURRENT_STATE.CPSR,
+           ref_cur.CPSR != CURRENT_STATE.CPSR ? "  <--" : "");
+    printf("RUN    %d           %d\n", ref_run, RUN_BIT);
+    if(bad >= 0)
+      printf("[0x%08x]  0x%08x  0x%08x  <--\n", SIM->undo_addr[bad], want,
+             got);
+    printf("\n");
+    RUN_BIT = 0;
+  }
+  return n;
+}
+
+int run_threaded (int max_instructions) {
+
+  static const void *labels[T_NLABELS] = {
+    &&t_cond, &&t_data, &&t_mem, &&t_pc, &&t_b, &&t_bl, &&t_swi, &&t_nop
+  };
+  int retired = 0;
+  tblock_t *blk;
+  top_t *op, *last;
+  uint32_t offset;
+
+#define COMMIT()                                                  \
+  do {                                                            \
+    NEXT_STATE.PC += 4;                                           \
+    CURRENT_STATE = NEXT_STATE;                                   \
+    if(++retired == max_instructions)                             \
+      goto out;                                                   \
+    if(op == last)                                                \
+      goto next_block;                                            \
+    op++;                                                         \
+    goto *op->label;                                              \
+  } while(0)
+
+  if(BLOCKS == NULL)
+    BLOCKS = calloc(PREDECODE_ENTRIES, sizeof(tblock_t *));
+  if(max_instructions <= 0 || !RUN_BIT)
+    return 0;
+
+ next_block:
+  if(BLOCKS_STALE)
+    flush_blocks();
+  offset = CURRENT_STATE.PC - TEXT_START;
+  if(offset >= TEXT_SIZE || (offset & 3)) {
+    /* outside the text region: fall back to the interpreter */
+    process_instruction();
+    CURRENT_STATE = NEXT_STATE;
+    if(++retired == max_instructions || !RUN_BIT)
+      goto out;
+    goto next_block;
+  }
+  blk = BLOCKS[offset >> 2];
+  if(blk == NULL)
+    blk = BLOCKS[offset >> 2] = translate_block(CURRENT_STATE.PC, labels);
+  if(ENGINE == ENGINE_JIT) {
+    if(blk->jit == NULL && ++blk->count == JIT_THRESHOLD)
+      promote_block(blk, CURRENT_STATE.PC);
+    if(blk->jit && blk->len <= max_instructions - retired) {
+      retired += JIT_CHECK ? check_block(blk) : blk->jit();
+      if(retired == max_instructions || !RUN_BIT)
+        goto out;
+      goto next_block;
+    }
+  }
+  op = &blk->ops[0];
+  last = &blk->ops[blk->len - 1];
+  goto *op->label;
+
+ t_cond:
+  if(!check_cond(op->d->cond))
+    COMMIT();
+  goto *op->body;
+
+ t_data:
+  op->fn.data(op->d->Rd, op->d->Rn, op->d->Operand2, op->d->I, op->d->S,
+              op->d->cond);
+  COMMIT();
+
+ t_mem:
+  op->fn.mem(op->d->Rd, op->d->Rn, op->d->Operand2, op->d->I);
+  COMMIT();
+
+ t_pc:
+  pc_process(op->d);
+  COMMIT();
+
+ t_b:
+  B(op->d->imm24);
+  COMMIT();
+
+ t_bl:
+  BL(op->d->imm24);
+  COMMIT();
+
+ t_swi:
+  SWI();
+  RUN_BIT = 0;
   NEXT_STATE.PC += 4;
+  CURRENT_STATE = NEXT_STATE;
+  retired++;
+  goto out;
+
+ t_nop:
+  COMMIT();
+
+ out:
+  return retired;
 
+#undef COMMIT
 }
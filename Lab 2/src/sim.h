@@ -0,0 +1,81 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_SIM_H_
+#define _SIM_SIM_H_
+
+#include <stdint.h>
+
+/*
+  Decoded form of one instruction word. Every field is extracted from
+  the uint32_t with shifts and masks, so nothing on the execute path
+  goes through a string.
+*/
+typedef struct inst_s inst_t;
+
+struct inst_s {
+  int (*exec)(inst_t *d); /* handler chosen at decode time     */
+  uint32_t word;
+  int valid;    /* predecode cache entry holds this word      */
+  int cond;     /* [31:28] condition code                     */
+  int op;       /* [27:26] 00 data, 01 memory, 10 branch      */
+  int I;        /* [25]    immediate (data) / ~I (memory)     */
+  int cmd;      /* [24:21] data processing opcode             */
+  int S;        /* [20]    set flags                          */
+  int Rn;       /* [19:16]                                    */
+  int Rd;       /* [15:12]                                    */
+  int Operand2; /* [11:0]  Operand2 / imm12 / src2            */
+  int P, U, B, W, L;
+  int imm24;    /* [23:0]  branch offset, sign extended       */
+  int rot;      /* [11:8]  immediate rotate amount, times two */
+  uint32_t imm; /* rotated imm8, imm12 or branch byte offset  */
+  int pc;       /* data or memory instruction using R15       */
+};
+
+/* Handlers decode() can pick for inst_t.exec. */
+int data_process (inst_t *d);
+int branch_process (inst_t *d);
+int mul_process (inst_t *d);
+int transfer_process (inst_t *d);
+int interruption_process (inst_t *d);
+int unknown_process (inst_t *d);
+
+void    decode (uint32_t word, inst_t *d);
+inst_t *fetch_decoded (uint32_t pc, inst_t *scratch);
+
+/* Run a data or memory instruction that uses R15 (inst_t.pc). */
+int pc_process (inst_t *d);
+
+/* The instruction can write R15 (a branch, or data or LDR to PC). */
+int ends_block (inst_t *d);
+
+/* Execute and commit one decoded instruction without tracing. */
+void step_decoded (inst_t *d);
+
+/* Evaluate a condition field against CURRENT_STATE.CPSR. */
+int cond_passed (int cond);
+
+/* Guest profiler (prof.c), interpreter only. */
+extern int PROFILE_ON;
+void prof_open (const char *folded_file, const char *program);
+void prof_commit (uint32_t pc, inst_t *d);
+void prof_report ();
+
+/* Branch predictor models (bpred.c), interpreter only. */
+extern int BPRED_ON;
+int  bpred_add (const char *spec);
+void bpred_update (uint32_t pc, uint32_t target, int taken);
+void bpred_report ();
+
+/* Lab 4 pipeline timing (pipe.c), interpreter only. */
+extern int PIPE_ON, PIPE_BTB, PIPE_RAS;
+void pipe_issue (uint32_t pc, uint32_t word, int executed);
+void pipe_report ();
+
+#endif
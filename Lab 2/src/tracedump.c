@@ -0,0 +1,148 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/*
+  tracedump: print or summarize a commit trace written by sim -ctrace.
+
+    tracedump [-pc lo[:hi]] [-reg n] [-addr lo[:hi]] [-mem] [-stores]
+              [-skip n] [-n max] [-stats] file
+
+  Filters combine; a record is printed if it passes all of them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefmt.h"
+
+static int parse_range (const char *s, uint32_t *lo, uint32_t *hi) {
+
+  char *end;
+
+  *lo = strtoul(s, &end, 0);
+  *hi = *end == ':' ? strtoul(end + 1, &end, 0) : *lo;
+  return *end == '\0' && *lo <= *hi ? 0 : -1;
+}
+
+static void usage (const char *prog) {
+
+  printf("usage: %s [-pc lo[:hi]] [-reg n] [-addr lo[:hi]] [-mem] [-stores]\n"
+         "       [-skip n] [-n max] [-stats] file\n", prog);
+  exit(1);
+}
+
+int main (int argc, char *argv[]) {
+
+  uint32_t pc_lo = 0, pc_hi = ~0u, addr_lo = 0, addr_hi = ~0u;
+  int reg = -1, mem_only = 0, stores_only = 0, stats = 0, arg = 1, i;
+  unsigned long long skip = 0, max = ~0ull, index = 0, shown = 0;
+  unsigned long long nblocks = 0, raw_total = 0, comp_total = 0;
+  unsigned long long nmem = 0, nstore = 0, njump = 0;
+  ctrace_rec_t *recs = malloc(sizeof(ctrace_rec_t) * CT_BLOCK_RECS);
+  size_t raw_cap = CT_BLOCK_RECS * CT_REC_MAX;
+  uint8_t *raw = malloc(raw_cap), *comp = malloc(LZ_BOUND(raw_cap));
+  ctrace_block_t hdr;
+  char magic[8];
+  FILE *in;
+
+  while (arg < argc && argv[arg][0] == '-') {
+    if (!strcmp(argv[arg], "-pc") && arg + 1 < argc) {
+      if (parse_range(argv[++arg], &pc_lo, &pc_hi) < 0)
+        usage(argv[0]);
+    } else if (!strcmp(argv[arg], "-addr") && arg + 1 < argc) {
+      if (parse_range(argv[++arg], &addr_lo, &addr_hi) < 0)
+        usage(argv[0]);
+      mem_only = 1;
+    } else if (!strcmp(argv[arg], "-reg") && arg + 1 < argc) {
+      reg = atoi(argv[++arg]);
+    } else if (!strcmp(argv[arg], "-mem")) {
+      mem_only = 1;
+    } else if (!strcmp(argv[arg], "-stores")) {
+      mem_only = stores_only = 1;
+    } else if (!strcmp(argv[arg], "-skip") && arg + 1 < argc) {
+      skip = strtoull(argv[++arg], NULL, 0);
+    } else if (!strcmp(argv[arg], "-n") && arg + 1 < argc) {
+      max = strtoull(argv[++arg], NULL, 0);
+    } else if (!strcmp(argv[arg], "-stats")) {
+      stats = 1;
+    } else {
+      usage(argv[0]);
+    }
+    arg++;
+  }
+  if (arg != argc - 1)
+    usage(argv[0]);
+
+  if ((in = fopen(argv[arg], "rb")) == NULL) {
+    printf("Error: Can't open %s\n", argv[arg]);
+    exit(1);
+  }
+  if (fread(magic, 1, 8, in) != 8 || memcmp(magic, CTRACE_MAGIC, 8)) {
+    printf("Error: %s is not a commit trace\n", argv[arg]);
+    exit(1);
+  }
+
+  while (shown < max && fread(&hdr, sizeof(hdr), 1, in) == 1) {
+    if (hdr.nrec > CT_BLOCK_RECS || hdr.raw_len > raw_cap ||
+        hdr.comp_len > hdr.raw_len ||
+        fread(comp, 1, hdr.comp_len, in) != hdr.comp_len ||
+        (hdr.comp_len == hdr.raw_len ? (memcpy(raw, comp, hdr.raw_len), 0) :
+         lz_decompress(comp, hdr.comp_len, raw, raw_cap) != hdr.raw_len) ||
+        ctrace_decode(raw, hdr.raw_len, recs, hdr.nrec) < 0) {
+      printf("Error: corrupt block %llu\n", nblocks);
+      exit(1);
+    }
+    nblocks++;
+    raw_total += hdr.raw_len;
+    comp_total += hdr.comp_len + sizeof(hdr);
+
+    for (i = 0; i < (int)hdr.nrec && shown < max; i++, index++) {
+      ctrace_rec_t *r = &recs[i];
+
+      if (stats) {
+        nmem += (r->flags & CT_MEM) != 0;
+        nstore += (r->flags & CT_STORE) != 0;
+        njump += (r->flags & CT_JUMP) && index;
+        continue;
+      }
+      if (index < skip || r->pc < pc_lo || r->pc > pc_hi)
+        continue;
+      if (reg >= 0 && (!(r->flags & CT_RD) || r->rd != reg))
+        continue;
+      if (mem_only && (!(r->flags & CT_MEM) || r->mem_addr < addr_lo ||
+                       r->mem_addr > addr_hi))
+        continue;
+      if (stores_only && !(r->flags & CT_STORE))
+        continue;
+
+      printf("%10llu  0x%08x: %08x  %c%c%c%c", index, r->pc, r->word,
+             CT_NZCV(r->flags) & 8 ? 'N' : '-', CT_NZCV(r->flags) & 4 ? 'Z' : '-',
+             CT_NZCV(r->flags) & 2 ? 'C' : '-', CT_NZCV(r->flags) & 1 ? 'V' : '-');
+      if (r->flags & CT_RD)
+        printf("  R%d=0x%08x", r->rd, r->rd_val);
+      if (r->flags & CT_MEM)
+        printf("  %s [0x%08x] 0x%08x", r->flags & CT_STORE ? "st" : "ld",
+               r->mem_addr, r->mem_data);
+      printf("\n");
+      shown++;
+    }
+  }
+
+  if (stats) {
+    printf("Records      : %llu in %llu blocks\n", index, nblocks);
+    printf("Memory ops   : %llu (%llu stores)\n", nmem, nstore);
+    printf("Taken jumps  : %llu\n", njump);
+    printf("Encoded      : %llu bytes\n", raw_total);
+    printf("On disk      : %llu bytes (%.2f bytes/record)\n", comp_total + 8,
+           index ? (double)(comp_total + 8) / index : 0.0);
+  }
+  fclose(in);
+  return 0;
+}
@@ -0,0 +1,234 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+/* Commit-trace record encoding and block compression (tracefmt.h). */
+
+#include <string.h>
+
+#include "tracefmt.h"
+
+static uint8_t *put_varint (uint8_t *p, uint32_t v) {
+
+  while (v >= 0x80) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+static const uint8_t *get_varint (const uint8_t *p, const uint8_t *end,
+                                  uint32_t *v) {
+
+  uint32_t x = 0;
+  int shift;
+
+  for (shift = 0; p < end && shift < 35; shift += 7) {
+    x |= (uint32_t)(*p & 0x7F) << shift;
+    if (!(*p++ & 0x80)) {
+      *v = x;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+#define ZIGZAG(d)   (((d) << 1) ^ (uint32_t)((int32_t)(d) >> 31))
+#define UNZIGZAG(z) (((z) >> 1) ^ (uint32_t)-(int32_t)((z) & 1))
+
+size_t ctrace_encode (const ctrace_rec_t *recs, int n, uint8_t *out) {
+
+  /* pc starts so that the decoder's first expected pc is 0 */
+  uint32_t regs[16] = { 0 }, pc = -4u, addr = 0;
+  uint8_t *p = out;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    const ctrace_rec_t *r = &recs[i];
+    uint8_t flags = r->flags & ~CT_JUMP;
+
+    if (r->pc != pc + 4)
+      flags |= CT_JUMP;
+    *p++ = flags;
+    if (flags & CT_JUMP)
+      p = put_varint(p, ZIGZAG(r->pc - (pc + 4)));
+    pc = r->pc;
+    memcpy(p, &r->word, 4);
+    p += 4;
+    if (flags & CT_RD) {
+      *p++ = r->rd;
+      p = put_varint(p, ZIGZAG(r->rd_val - regs[r->rd & 15]));
+      regs[r->rd & 15] = r->rd_val;
+    }
+    if (flags & CT_MEM) {
+      p = put_varint(p, ZIGZAG(r->mem_addr - addr));
+      p = put_varint(p, r->mem_data);
+      addr = r->mem_addr;
+    }
+  }
+  return p - out;
+}
+
+int ctrace_decode (const uint8_t *in, size_t len, ctrace_rec_t *recs, int n) {
+
+  uint32_t regs[16] = { 0 }, pc = 0, addr = 0, v;
+  const uint8_t *p = in, *end = in + len;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    ctrace_rec_t *r = &recs[i];
+
+    if (p >= end)
+      return -1;
+    r->flags = *p++;
+    if (r->flags & CT_JUMP) {
+      if ((p = get_varint(p, end, &v)) == NULL)
+        return -1;
+      pc += UNZIGZAG(v);
+    }
+    r->pc = pc;
+    pc += 4;
+    if (end - p < 4)
+      return -1;
+    memcpy(&r->word, p, 4);
+    p += 4;
+    r->rd = 0;
+    r->rd_val = 0;
+    if (r->flags & CT_RD) {
+      if (p >= end)
+        return -1;
+      r->rd = *p++ & 15;
+      if ((p = get_varint(p, end, &v)) == NULL)
+        return -1;
+      r->rd_val = regs[r->rd] += UNZIGZAG(v);
+    }
+    r->mem_addr = r->mem_data = 0;
+    if (r->flags & CT_MEM) {
+      if ((p = get_varint(p, end, &v)) == NULL)
+        return -1;
+      r->mem_addr = addr += UNZIGZAG(v);
+      if ((p = get_varint(p, end, &r->mem_data)) == NULL)
+        return -1;
+    }
+  }
+  return p == end ? 0 : -1;
+}
+
+/*
+  LZ77 in the LZ4 block layout: each sequence is a token (literal
+  count in the high nibble, match length - 4 in the low one, 15 meaning
+  "more bytes follow"), the literals, a 16-bit little-endian offset and
+  any extra match length. The last sequence has literals only.
+*/
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+
+static uint8_t *put_length (uint8_t *p, size_t len) {
+
+  for (; len >= 255; len -= 255)
+    *p++ = 255;
+  *p++ = len;
+  return p;
+}
+
+static uint8_t *put_sequence (uint8_t *p, const uint8_t *lit, size_t nlit,
+                              size_t offset, size_t mlen) {
+
+  size_t m = mlen ? mlen - LZ_MIN_MATCH : 0;
+  uint8_t *token = p++;
+
+  *token = (nlit < 15 ? nlit : 15) << 4;
+  if (nlit >= 15)
+    p = put_length(p, nlit - 15);
+  memcpy(p, lit, nlit);
+  p += nlit;
+  if (mlen) {
+    *token |= m < 15 ? m : 15;
+    *p++ = offset;
+    *p++ = offset >> 8;
+    if (m >= 15)
+      p = put_length(p, m - 15);
+  }
+  return p;
+}
+
+size_t lz_compress (const uint8_t *src, size_t n, uint8_t *dst) {
+
+  uint32_t table[1 << LZ_HASH_BITS];
+  size_t ip = 0, anchor = 0;
+  uint8_t *op = dst;
+
+  memset(table, 0, sizeof(table));
+  while (ip + LZ_MIN_MATCH <= n) {
+    uint32_t seq, h, cand;
+
+    memcpy(&seq, src + ip, 4);
+    h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    cand = table[h];
+    table[h] = ip + 1;
+    if (cand && ip - (cand - 1) <= 0xFFFF &&
+        !memcmp(src + cand - 1, src + ip, LZ_MIN_MATCH)) {
+      size_t m = cand - 1, len = LZ_MIN_MATCH;
+
+      while (ip + len < n && src[m + len] == src[ip + len])
+        len++;
+      op = put_sequence(op, src + anchor, ip - anchor, ip - m, len);
+      ip += len;
+      anchor = ip;
+    } else {
+      ip++;
+    }
+  }
+  op = put_sequence(op, src + anchor, n - anchor, 0, 0);
+  return op - dst;
+}
+
+size_t lz_decompress (const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+
+  const uint8_t *ip = src, *end = src + n;
+  size_t op = 0, len, offset;
+
+  while (ip < end) {
+    uint8_t token = *ip++;
+
+    len = token >> 4;
+    if (len == 15)
+      do {
+        if (ip >= end)
+          return (size_t)-1;
+        len += *ip;
+      } while (*ip++ == 255);
+    if (len > (size_t)(end - ip) || len > cap - op)
+      return (size_t)-1;
+    memcpy(dst + op, ip, len);
+    ip += len;
+    op += len;
+    if (ip == end)
+      break;
+
+    if (end - ip < 2)
+      return (size_t)-1;
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    len = (token & 15);
+    if (len == 15)
+      do {
+        if (ip >= end)
+          return (size_t)-1;
+        len += *ip;
+      } while (*ip++ == 255);
+    len += LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || len > cap - op)
+      return (size_t)-1;
+    /* byte at a time: the match may overlap what it produces */
+    for (; len; len--, op++)
+      dst[op] = dst[op - offset];
+  }
+  return op;
+}
@@ -0,0 +1,69 @@
+/***************************************************************/
+/*                                                             */
+/*   ARMv4-32 Instruction Level Simulator                      */
+/*                                                             */
+/*   ECEN 4243                                                 */
+/*   Oklahoma State University                                 */
+/*                                                             */
+/***************************************************************/
+
+#ifndef _SIM_TRACEFMT_H_
+#define _SIM_TRACEFMT_H_
+
+/*
+  Binary commit trace (-ctrace), shared by the simulator and tracedump.
+
+  File: the 8-byte magic, then blocks. Each block is a ctrace_block_t
+  header followed by comp_len bytes; comp_len == raw_len means the
+  block is stored uncompressed. Integers are in host byte order.
+
+  A block holds nrec records, delta-encoded on their own (no state
+  carries over from the previous block), then LZ-compressed:
+
+    flags     CT_* bits, NZCV in the top nibble
+    pc        zigzag varint of pc - (previous pc + 4), only if CT_JUMP
+    word      4 bytes
+    rd, val   register number and zigzag varint of the change from the
+              last value recorded for it, only if CT_RD
+    addr,data zigzag varint of addr - previous addr and varint of data,
+              only if CT_MEM
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CTRACE_MAGIC "ARMTRC1"
+
+#define CT_RD    0x01 /* a register other than PC was written    */
+#define CT_MEM   0x02 /* memory was accessed                     */
+#define CT_STORE 0x04 /* ... and the access was a store          */
+#define CT_JUMP  0x08 /* pc is not the previous pc + 4 (encoding) */
+
+#define CT_NZCV(flags) (((flags) >> 4) & 0xF)
+
+#define CT_BLOCK_RECS 4096
+#define CT_REC_MAX    27 /* worst-case encoded record */
+
+typedef struct {
+  uint32_t pc, word;
+  uint32_t rd_val;
+  uint32_t mem_addr, mem_data;
+  uint8_t rd, flags;
+} ctrace_rec_t;
+
+typedef struct {
+  uint32_t nrec, raw_len, comp_len;
+} ctrace_block_t;
+
+/* out needs n * CT_REC_MAX bytes; returns bytes written */
+size_t ctrace_encode (const ctrace_rec_t *recs, int n, uint8_t *out);
+/* returns 0, or -1 if the block is corrupt */
+int    ctrace_decode (const uint8_t *in, size_t len, ctrace_rec_t *recs, int n);
+
+/* LZ77 block codec; dst for lz_compress needs LZ_BOUND(n) bytes */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+size_t lz_compress (const uint8_t *src, size_t n, uint8_t *dst);
+/* returns bytes produced, or (size_t)-1 if src is corrupt */
+size_t lz_decompress (const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+
+#endif
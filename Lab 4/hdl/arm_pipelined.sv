@@ -74,7 +74,8 @@
 //    1101  Signed less/equal             N != V | Z = 1
 //    1110  Always                        any
 
-module arm (input  logic        clk, reset,
+module arm #(parameter BTBEntries = 16, RASDepth = 4)
+           (input  logic        clk, reset,
             output logic [31:0] PCF,
             input  logic [31:0] InstrF,
             output logic        MemWriteM,
@@ -87,12 +88,14 @@ module arm (input  logic        clk, reset,
    logic [1:0]  ImmSrcD;
    logic [3:0]  ALUControlE;
    logic        ALUSrcE, BranchTakenE, MemtoRegW,
-                PCSrcW, RegWriteW;
+                PCSrcW;
+   logic        RegWriteW /*verilator public*/;
    logic [3:0]  ALUFlagsE;
    logic [31:0] InstrD;
    logic        RegWriteM, MemtoRegE, PCWrPendingF;
    logic [1:0]  ForwardAE, ForwardBE;
    logic        StallF, StallD, FlushD, FlushE;
+   logic        BranchE, ReturnD, ReturnE, MispredictE;
    logic        Match_1E_M, Match_1E_W, 
                 Match_2E_M, Match_2E_W, 
                 Match_12D_E;
@@ -105,6 +108,9 @@ module arm (input  logic        clk, reset,
                  .ImmSrcD(ImmSrcD), 
                  .ALUSrcE(ALUSrcE),
                  .BranchTakenE(BranchTakenE),
+                 .BranchE(BranchE),
+                 .ReturnD(ReturnD),
+                 .ReturnE(ReturnE),
                  .ALUControlE(ALUControlE),
                  .MemWriteM(MemWriteM),
                  .MemtoRegW(MemtoRegW),
@@ -119,12 +125,14 @@ module arm (input  logic        clk, reset,
                  .MemSysReady(PCReady),
                  .I(I),
                  .compareOnly(compareOnly));
-   datapath dp (.clk(clk),
+   datapath #(BTBEntries, RASDepth) dp (.clk(clk),
                 .reset(reset),
                 .RegSrcD(RegSrcD),
                 .ImmSrcD(ImmSrcD),
                 .ALUSrcE(ALUSrcE),
                 .BranchTakenE(BranchTakenE),
+                .BranchE(BranchE),
+                .ReturnE(ReturnE),
                 .ALUControlE(ALUControlE), 
                 .MemtoRegW(MemtoRegW),
                 .PCSrcW(PCSrcW),
@@ -147,6 +155,8 @@ module arm (input  logic        clk, reset,
                 .StallF(StallF),
                 .StallD(StallD),
                 .FlushD(FlushD),
+                .FlushE(FlushE),
+                .MispredictE(MispredictE),
                 .MemSysReady(PCReady),
                 .I(I),
                 .instr(instr),
@@ -160,7 +170,7 @@ module arm (input  logic        clk, reset,
              .Match_12D_E(Match_12D_E),
              .RegWriteM(RegWriteM),
              .RegWriteW(RegWriteW),
-             .BranchTakenE(BranchTakenE),
+             .MispredictE(MispredictE),
              .MemtoRegE(MemtoRegE),
              .PCWrPendingF(PCWrPendingF),
              .PCSrcW(PCSrcW),
@@ -170,6 +180,77 @@ module arm (input  logic        clk, reset,
              .StallD(StallD),
              .FlushD(FlushD),
              .FlushE(FlushE));
+
+   // mov pc, lr (any condition): predicted from the return-address
+   //   stack and checked in Execute like a branch
+   assign ReturnD = (InstrD[27:0] == 28'h1A0F00E);
+
+   // Instruction in each later stage, for co-simulation (sim_main.cpp
+   // -cosim) and halt detection (top.sv); the ALU takes I and the
+   // shift from InstrE. Flushed stages hold 0, which is also a legal
+   // instruction (andeq r0, r0, r0), so ValidD/E/M/W mark the stages
+   // holding a real one: set when Decode loads from Fetch, cleared
+   // with FlushD/FlushE.
+   logic [31:0] InstrE /*verilator public*/;
+   logic [31:0] InstrM /*verilator public*/;
+   logic [31:0] InstrW /*verilator public*/;
+   logic        ValidD, ValidE, ValidM;
+   logic        ValidW /*verilator public*/;
+   assign instr = InstrE;
+   flopenrc #(32) instrereg (.clk(clk),
+                             .reset(reset),
+                             .en(PCReady),
+                             .clear(FlushE),
+                             .d(InstrD),
+                             .q(InstrE));
+   flopenr #(32) instrmreg (.clk(clk),
+                            .reset(reset),
+                            .en(PCReady),
+                            .d(InstrE),
+                            .q(InstrM));
+   flopenr #(32) instrwreg (.clk(clk),
+                            .reset(reset),
+                            .en(PCReady),
+                            .d(InstrM),
+                            .q(InstrW));
+   flopenrc #(1) validdreg (.clk(clk),
+                            .reset(reset),
+                            .en(~StallD & PCReady),
+                            .clear(FlushD),
+                            .d(1'b1),
+                            .q(ValidD));
+   flopenrc #(1) validereg (.clk(clk),
+                            .reset(reset),
+                            .en(PCReady),
+                            .clear(FlushE),
+                            .d(ValidD),
+                            .q(ValidE));
+   flopenr #(1) validmreg (.clk(clk),
+                           .reset(reset),
+                           .en(PCReady),
+                           .d(ValidE),
+                           .q(ValidM));
+   flopenr #(1) validwreg (.clk(clk),
+                           .reset(reset),
+                           .en(PCReady),
+                           .d(ValidM),
+                           .q(ValidW));
+
+   // Performance counters (sim_main.cpp, tb.sv): cycles out of reset
+   // and instructions leaving Writeback; branch counts are in btb.
+   logic [31:0] Cycles /*verilator public*/;
+   logic [31:0] Retired /*verilator public*/;
+   always_ff @(posedge clk, posedge reset)
+     if (reset)
+       begin
+          Cycles  <= 0;
+          Retired <= 0;
+       end
+     else
+       begin
+          Cycles <= Cycles + 1;
+          if (PCReady & ValidW) Retired <= Retired + 1;
+       end
    
 endmodule // arm
 
@@ -178,7 +259,9 @@ module controller (input  logic         clk, reset,
                    input  logic [3:0]   ALUFlagsE,
                    output logic [2:0]   RegSrcD, 
                    output logic [1:0]   ImmSrcD, 
-                   output logic         ALUSrcE, BranchTakenE,
+                   output logic         ALUSrcE, BranchTakenE, BranchE,
+                   input  logic         ReturnD,
+                   output logic         ReturnE,
                    output logic [3:0]   ALUControlE,
                    output logic         MemWriteM,
                    output logic         MemtoRegW, PCSrcW, RegWriteW,
@@ -198,7 +281,7 @@ module controller (input  logic         clk, reset,
    logic        MemtoRegD, MemtoRegM;
    logic        RegWriteD, RegWriteE, RegWriteGatedE;
    logic        MemWriteD, MemWriteE, MemWriteGatedE;
-   logic        BranchD, BranchE;
+   logic        BranchD;
    logic [1:0]  FlagWriteD, FlagWriteE;
    logic        PCSrcD, PCSrcE, PCSrcM;
    logic [3:0]  FlagsE, FlagsNextE, CondE;
@@ -272,17 +355,22 @@ module controller (input  logic         clk, reset,
          FlagWriteD  = 2'b00; // don't update Flags
        end
 
-   assign PCSrcD = (((InstrD[15:12] == 4'b1111) & RegWriteD) | BranchD);
+   // Branches and returns are predicted in Fetch (btb, ras) and
+   //   resolved in Execute, so only other writes to R15 wait for
+   //   Writeback; a return writes no register
+   assign PCSrcD = ((InstrD[15:12] == 4'b1111) & RegWriteD & 
+                    ~BranchD & ~ReturnD);
    assign I         = InstrD[25];
    
    // Execute stage
-   flopenrc #(8) flushedregsE(.clk(clk),
+   flopenrc #(9) flushedregsE(.clk(clk),
                             .reset(reset),
                             .en(MemSysReady),
                             .clear(FlushE), 
-                            .d({FlagWriteD, BranchD, MemWriteD, 
-                                RegWriteD, PCSrcD, MemtoRegD, MemStrobeD}),
-                            .q({FlagWriteE, BranchE, MemWriteE, 
+                            .d({FlagWriteD, BranchD, ReturnD, MemWriteD, 
+                                RegWriteD & ~ReturnD, PCSrcD, MemtoRegD,
+                                MemStrobeD}),
+                            .q({FlagWriteE, BranchE, ReturnE, MemWriteE, 
                                 RegWriteE, PCSrcE, MemtoRegE, MemStrobeE}));
    flopenr #(5)  regsE(.clk(clk),
                      .reset(reset),
@@ -308,7 +396,7 @@ module controller (input  logic         clk, reset,
                      .FlagsWrite(FlagWriteE), 
                      .CondEx(CondExE),
                      .FlagsNext(FlagsNextE));
-   assign BranchTakenE    = BranchE & CondExE;
+   assign BranchTakenE    = (BranchE | ReturnE) & CondExE;
    assign RegWriteGatedE  = RegWriteE & CondExE & ~compareOnly;
    assign MemWriteGatedE  = MemWriteE & CondExE;
    assign PCSrcGatedE     = PCSrcE & CondExE;
@@ -374,10 +462,12 @@ module conditional (input  logic [3:0] Cond,
 
 endmodule // conditional
 
-module datapath (input  logic        clk, reset,
+module datapath #(parameter BTBEntries = 16, RASDepth = 4)
+                (input  logic        clk, reset,
                  input  logic [2:0]  RegSrcD,
                  input  logic [1:0]  ImmSrcD,
-                 input  logic        ALUSrcE, BranchTakenE,
+                 input  logic        ALUSrcE, BranchTakenE, BranchE,
+                 input  logic        ReturnE,
                  input  logic [3:0]  ALUControlE, 
                  input  logic        MemtoRegW, PCSrcW, RegWriteW,
                  output logic [31:0] PCF,
@@ -390,32 +480,75 @@ module datapath (input  logic        clk, reset,
                  output logic        Match_1E_M, Match_1E_W, 
                  output logic        Match_2E_M, Match_2E_W, Match_12D_E,
                  input  logic [1:0]  ForwardAE, ForwardBE,
-                 input  logic        StallF, StallD, FlushD,
+                 input  logic        StallF, StallD, FlushD, FlushE,
+                 output logic        MispredictE,
                  input  logic        MemSysReady,
                  input logic         I,
                  input logic  [31:0] instr,
                  output logic         compareOnly);
    
-   logic [31:0] PCPlus4F, PCnext1F, PCnextF;
-   logic [31:0] PCPlus4D, PCPlus4E, PCPlus4M, PCPlus4W;   
+   logic [31:0] PCPlus4F, PCPredF, PCnext1F, PCnextF;
+   logic [31:0] PredTargetF, PredTargetD, PredTargetE, RedirectE;
+   logic        PredTakenF, PredTakenD, PredTakenE;
+   logic [31:0] BTBTargetF, RetTargetF;
+   logic        BTBTakenF, RetTakenF, ReturnF;
+   logic [31:0] ALUOrLinkE;
+   logic [31:0] PCPlus4D, PCPlus4E, PCPlus4M;
+   logic [31:0] PCPlus4W /*verilator public*/;
    logic [31:0] ExtImmD, rd1D, rd2D, PCPlus8D;
    logic [31:0] rd1E, rd2E, ExtImmE, SrcAE, SrcBE;
    logic [31:0] WriteDataE, ALUResultE;
    logic [31:0] ReadDataW, ALUOutW, ResultW;
-   logic [3:0]  RA1D, RA2D, RA3D, RA1E, RA2E;
-   logic [31:0] RA4D;   
-   logic [3:0]  WA3E, WA3M, WA3W;
+   logic [3:0]  RA1D, RA2D, RA1E, RA2E;
+   logic [3:0]  RA3D /*verilator public*/;  // register file write port
+   logic [31:0] RA4D /*verilator public*/;   
+   logic [3:0]  WA3D, WA3E, WA3M, WA3W;
    logic        Match_1D_E, Match_2D_E;
    logic [2:0]  RegSrcE, RegSrcM, RegSrcW;
       
    // Fetch stage
-   mux2 #(32) pcnextmux (.d0(PCPlus4F),
+   //   the BTB (or for a return the RAS) picks the next PC; a
+   //   mispredicted branch in Execute and other PC writes (from
+   //   Writeback) override it
+   btb #(BTBEntries) bp (.clk(clk),
+                         .reset(reset),
+                         .en(MemSysReady),
+                         .PCPlus4F(PCPlus4F),
+                         .PredTakenF(BTBTakenF),
+                         .PredTargetF(BTBTargetF),
+                         .BranchE(BranchE),
+                         .TakenE(BranchTakenE),
+                         .MispredictE(MispredictE),
+                         .PCPlus4E(PCPlus4E),
+                         .TargetE(ALUResultE));
+   assign ReturnF = (InstrF[27:0] == 28'h1A0F00E);   // mov pc, lr
+   ras #(RASDepth) rs (.clk(clk),
+                       .reset(reset),
+                       .en(MemSysReady),
+                       .ReturnF(ReturnF),
+                       .PredTakenF(RetTakenF),
+                       .PredTargetF(RetTargetF),
+                       .PushE(BranchTakenE & RegSrcE[2]),    // BL
+                       .ReturnE(ReturnE),
+                       .PopE(BranchTakenE & ReturnE),
+                       .MispredictE(MispredictE),
+                       .LinkE(PCPlus4E));
+   assign PredTakenF = RetTakenF | BTBTakenF;
+   mux2 #(32) rasmux (.d0(BTBTargetF),
+                      .d1(RetTargetF),
+                      .s(RetTakenF),
+                      .y(PredTargetF));
+   mux2 #(32) predmux (.d0(PCPlus4F),
+                       .d1(PredTargetF),
+                       .s(PredTakenF),
+                       .y(PCPredF));
+   mux2 #(32) pcnextmux (.d0(PCPredF),
                          .d1(ResultW),
                          .s(PCSrcW),
                          .y(PCnext1F));
    mux2 #(32) branchmux (.d0(PCnext1F),
-                         .d1(ALUResultE),
-                         .s(BranchTakenE),
+                         .d1(RedirectE),
+                         .s(MispredictE),
                          .y(PCnextF));
    flopenr #(32) pcreg (.clk(clk),
                         .reset(reset),
@@ -427,7 +560,10 @@ module datapath (input  logic        clk, reset,
                       .y(PCPlus4F));
    
    // Decode Stage
-   assign PCPlus8D = PCPlus4F; // skip register
+   //   (PCPlus4F is not PC+8 after a predicted-taken branch)
+   adder #(32) pcadd8 (.a(PCPlus4D),
+                       .b(32'h4),
+                       .y(PCPlus8D));
    flopenrc #(32) instrreg (.clk(clk),
                             .reset(reset),
                             .en(~StallD & MemSysReady),
@@ -440,6 +576,12 @@ module datapath (input  logic        clk, reset,
                            .clear(FlushD),
                            .d(PCPlus4F),
                            .q(PCPlus4D));
+   flopenrc #(33) predregd (.clk(clk),
+                            .reset(reset),
+                            .en(~StallD & MemSysReady),
+                            .clear(FlushD),
+                            .d({PredTakenF, PredTargetF}),
+                            .q({PredTakenD, PredTargetD}));
    mux2 #(4)   ra1mux (.d0(InstrD[19:16]),
                        .d1(4'b1111),
                        .s(RegSrcD[0]),
@@ -468,6 +610,10 @@ module datapath (input  logic        clk, reset,
    extend      ext (.Instr(InstrD[23:0]),
                     .ImmSrc(ImmSrcD),
                     .ExtImm(ExtImmD));
+   mux2 #(4)   wa3mux (.d0(InstrD[15:12]),   // BL writes LR
+                       .d1(4'hE),
+                       .s(RegSrcD[2]),
+                       .y(WA3D));
    
    // Execute Stage
    flopenr #(32) rd1reg (.clk(clk),
@@ -488,7 +634,7 @@ module datapath (input  logic        clk, reset,
    flopenr #(4)  wa3ereg (.clk(clk),
                         .reset(reset),
                         .en(MemSysReady),
-                        .d(InstrD[15:12]),
+                        .d(WA3D),
                         .q(WA3E));
    flopenr #(4)  ra1reg (.clk(clk),
                        .reset(reset),
@@ -510,6 +656,12 @@ module datapath (input  logic        clk, reset,
                         .en(MemSysReady),
                         .d(RegSrcD),
                         .q(RegSrcE));
+   flopenrc #(33) predrege (.clk(clk),
+                            .reset(reset),
+                            .en(MemSysReady),
+                            .clear(FlushE),
+                            .d({PredTakenD, PredTargetD}),
+                            .q({PredTakenE, PredTargetE}));
    mux3 #(32)  byp1mux (.d0(rd1E),
                         .d1(ResultW),
                         .d2(ALUOutM),
@@ -529,15 +681,32 @@ module datapath (input  logic        clk, reset,
                     .ALUControl(ALUControlE),
                     .Result(ALUResultE),
                     .Flags(ALUFlagsE),
-                    .I(I),
+                    .I(instr[25]),      // Execute's, from InstrE
                     .instr(instr),
                     .compareOnly(compareOnly));
+
+   // Branch check: the fetch after a branch or return went to
+   //   PredTargetE if PredTakenE, else PC+4; redirect when that was
+   //   wrong (ALUResultE is the target, LR for a return)
+   mux2 #(32)  redirmux (.d0(PCPlus4E),
+                         .d1(ALUResultE),
+                         .s(BranchTakenE),
+                         .y(RedirectE));
+   assign MispredictE = BranchTakenE ?
+                        ~PredTakenE | (PredTargetE != ALUResultE) :
+                        PredTakenE;
+   // BL: the target went to Fetch, LR (PC+4) goes on down the
+   //   pipeline so it forwards like any other result
+   mux2 #(32)  linkmux (.d0(ALUResultE),
+                        .d1(PCPlus4E),
+                        .s(RegSrcE[2]),
+                        .y(ALUOrLinkE));
    
    // Memory Stage
    flopenr #(32) aluresreg (.clk(clk),
                             .reset(reset),
                             .en(MemSysReady),
-                            .d(ALUResultE),
+                            .d(ALUOrLinkE),
                             .q(ALUOutM));
    flopenr #(32) wdreg (.clk(clk),
                         .reset(reset),
@@ -618,7 +787,7 @@ module hazard (input  logic       clk, reset,
                input  logic       Match_1E_M, Match_1E_W, 
                input  logic       Match_2E_M, Match_2E_W, Match_12D_E,
                input  logic       RegWriteM, RegWriteW,
-               input  logic       BranchTakenE, MemtoRegE,
+               input  logic       MispredictE, MemtoRegE,
                input  logic       PCWrPendingF, PCSrcW,
                output logic [1:0] ForwardAE, ForwardBE,
                output logic       StallF, StallD,
@@ -642,8 +811,9 @@ module hazard (input  logic       clk, reset,
    //   when an instruction reads a register loaded by the previous,
    //   stall in the decode stage until it is ready
    // Branch hazard
-   //   When a branch is taken, flush the incorrectly fetched instrs
-   //   from decode and execute stages
+   //   When a branch was mispredicted (btb), flush the incorrectly
+   //   fetched instrs from decode and execute stages; the redirect
+   //   overrides a fetch stall from the wrong-path instr in decode
    // PC Write Hazard
    //   When the PC might be written, stall all following instructions
    //   by stalling the fetch and flushing the decode stage
@@ -652,19 +822,169 @@ module hazard (input  logic       clk, reset,
    assign ldrStallD = Match_12D_E & MemtoRegE;
    
    assign StallD = ldrStallD;
-   assign StallF = ldrStallD | PCWrPendingF; 
-   assign FlushE = ldrStallD | BranchTakenE; 
-   assign FlushD = PCWrPendingF | PCSrcW | BranchTakenE;
+   assign StallF = (ldrStallD | PCWrPendingF) & ~MispredictE; 
+   assign FlushE = ldrStallD | MispredictE; 
+   assign FlushD = PCWrPendingF | PCSrcW | MispredictE;
    
 endmodule // hazard
 
+// Branch target buffer: Entries (a power of two, 0 for none) direct-
+//   mapped entries of tag, target and a 2-bit saturating counter,
+//   indexed by PC+4 of the branch (which Fetch and Execute already
+//   have). Fetch predicts taken on a hit with the counter >= 2;
+//   Execute updates the counter on every branch, and a taken branch
+//   that missed takes the entry as weakly taken.
+module btb #(parameter Entries = 16)
+   (input  logic        clk, reset, en,
+    input  logic [31:0] PCPlus4F,
+    output logic        PredTakenF,
+    output logic [31:0] PredTargetF,
+    input  logic        BranchE, TakenE, MispredictE,
+    input  logic [31:0] PCPlus4E, TargetE);
+
+   // performance counters
+   logic [31:0] Branches /*verilator public*/;
+   logic [31:0] Mispredicts /*verilator public*/;
+
+   always_ff @(posedge clk, posedge reset)
+     if (reset)
+       begin
+          Branches    <= 0;
+          Mispredicts <= 0;
+       end
+     else if (en)
+       begin
+          if (BranchE)     Branches    <= Branches + 1;
+          if (BranchE & MispredictE) Mispredicts <= Mispredicts + 1;
+       end
+
+   generate
+      if (Entries == 0)
+        begin
+           assign PredTakenF  = 1'b0;
+           assign PredTargetF = PCPlus4F;
+        end
+      else
+        begin
+           localparam IdxBits = $clog2(Entries);
+
+           logic                valid[Entries-1:0];
+           logic [31:IdxBits+2] tag[Entries-1:0];
+           logic [31:0]         target[Entries-1:0];
+           logic [1:0]          count[Entries-1:0];
+           logic [IdxBits-1:0]  idxF, idxE;
+           logic                hitE;
+
+           assign idxF = PCPlus4F[IdxBits+1:2];
+           assign idxE = PCPlus4E[IdxBits+1:2];
+           assign PredTakenF  = valid[idxF] & count[idxF][1] &
+                                (tag[idxF] == PCPlus4F[31:IdxBits+2]);
+           assign PredTargetF = target[idxF];
+           assign hitE = valid[idxE] & (tag[idxE] == PCPlus4E[31:IdxBits+2]);
+
+           always_ff @(posedge clk, posedge reset)
+             if (reset)
+               for (int i = 0; i < Entries; i++) valid[i] <= 1'b0;
+             else if (en & BranchE)
+               if (hitE)
+                 begin
+                    if (TakenE)
+                      begin
+                         target[idxE] <= TargetE;
+                         if (count[idxE] != 2'b11) count[idxE] <= count[idxE] + 1;
+                      end
+                    else if (count[idxE] != 2'b00)
+                      count[idxE] <= count[idxE] - 1;
+                 end
+               else if (TakenE)
+                 begin
+                    valid[idxE]  <= 1'b1;
+                    tag[idxE]    <= PCPlus4E[31:IdxBits+2];
+                    target[idxE] <= TargetE;
+                    count[idxE]  <= 2'b10;
+                 end
+        end
+   endgenerate
+
+endmodule // btb
+
+// Return-address stack: Depth entries (a power of two, 0 for none),
+//   circular, so a push onto a full stack drops the oldest. A taken BL
+//   pushes PC+4 and a taken return pops, both in Execute where nothing
+//   is speculative any more, so a mispredict needs no repair. Fetch
+//   predicts a return it is fetching to the top entry (a return that
+//   follows its BL within two cycles sees the entry before).
+module ras #(parameter Depth = 4)
+   (input  logic        clk, reset, en,
+    input  logic        ReturnF,
+    output logic        PredTakenF,
+    output logic [31:0] PredTargetF,
+    input  logic        PushE, ReturnE, PopE, MispredictE,
+    input  logic [31:0] LinkE);
+
+   // performance counters
+   logic [31:0] Returns /*verilator public*/;
+   logic [31:0] ReturnMispredicts /*verilator public*/;
+
+   always_ff @(posedge clk, posedge reset)
+     if (reset)
+       begin
+          Returns           <= 0;
+          ReturnMispredicts <= 0;
+       end
+     else if (en)
+       begin
+          if (ReturnE)               Returns <= Returns + 1;
+          if (ReturnE & MispredictE) ReturnMispredicts <= ReturnMispredicts + 1;
+       end
+
+   generate
+      if (Depth == 0)
+        begin
+           assign PredTakenF  = 1'b0;
+           assign PredTargetF = 32'b0;
+        end
+      else
+        begin
+           localparam PtrBits = $clog2(Depth);
+
+           logic [31:0]        stack[Depth-1:0];
+           logic [PtrBits-1:0] tos;
+           logic [PtrBits:0]   count;
+
+           assign PredTakenF  = ReturnF & (count != 0);
+           assign PredTargetF = stack[tos];
+
+           always_ff @(posedge clk, posedge reset)
+             if (reset)
+               begin
+                  tos   <= 0;
+                  count <= 0;
+               end
+             else if (en)
+               if (PushE)
+                 begin
+                    tos               <= tos + 1'b1;
+                    stack[tos + 1'b1] <= LinkE;
+                    if (count != Depth) count <= count + 1'b1;
+                 end
+               else if (PopE & (count != 0))
+                 begin
+                    tos   <= tos - 1'b1;
+                    count <= count - 1'b1;
+                 end
+        end
+   endgenerate
+
+endmodule // ras
+
 module regfile (input  logic        clk, 
                 input  logic        we3, 
                 input  logic [3:0]  ra1, ra2, wa3, 
                 input  logic [31:0] wd3, r15,
                 output logic [31:0] rd1, rd2);
    
-   logic [31:0] rf[14:0];
+   logic [31:0] rf[14:0] /*verilator public*/;
 
    // three ported register file
    // read two ports combinationally
@@ -743,33 +1063,33 @@ module alu (input  logic [31:0] a, b,
                       if(I) 
                         Result = b;
                       else begin
-                        casex(b[6:5])
-                          2'b00: Result = instr[3:0] << instr[11:7];
-                          2'b01: Result = instr[3:0] >> instr[11:7];
-                          2'b10: Result = instr[3:0] >>> instr[11:7];
-                          2'b11: Result = (instr[3:0] >> instr[11:7]) | (instr[3:0] << (6'b100000 - instr[11:7]));
+                        casex(instr[6:5])   // Rm (b) by shamt5
+                          2'b00: Result = b << instr[11:7];
+                          2'b01: Result = b >> instr[11:7];
+                          2'b10: Result = $signed(b) >>> instr[11:7];
+                          2'b11: Result = (b >> instr[11:7]) | (b << (6'b100000 - instr[11:7]));
                           default: Result = 32'bx;
                         endcase
                       end
                  end
        4'b0110:  Result = a & ~b; // BIC
        4'b0111:  begin            // CMN
-                      assign fakeReg = a + b; 
+                      fakeReg = a + b; 
                       compareOnly = 1; 
                 end
        4'b1000:  begin            // CMP
-                      assign fakeReg = a - b; 
+                      fakeReg = a - b; 
                       compareOnly = 1; 
                 end 
        4'b1001:  Result = a ^ b; // EOR ??
        4'b1010:  Result = ~a; // MVN
        4'b1011:  Result = a | b; // ORR
        4'b1100:  begin // TEQ
-                      assign fakeReg = a ^ b;
+                      fakeReg = a ^ b;
                       compareOnly = 1;
                  end
        4'b1101:  begin // TST
-                      assign fakeReg = a & b;
+                      fakeReg = a & b;
                       compareOnly = 1;
                  end
        default: Result = 32'bx;
@@ -0,0 +1,293 @@
+//------------------------------------------------
+// dcache.sv
+// Oklahoma State University
+// ECEN 4243
+// Data cache and write buffer between arm and dmem
+//------------------------------------------------
+//
+// Write-back, write-allocate: Sets x Ways lines of LineWords words
+// (Sets and LineWords powers of two >= 2; Sets = 0 passes every access
+// straight to dmem). MemStrobe is the request from Memory and Ready
+// goes into PCReady, as dmem's did, so a miss holds the whole pipeline.
+//
+// Stores go into a WBEntries-word write buffer (a store to a word
+// already there overwrites it), so they retire in one cycle unless
+// the buffer is full. Loads read the buffer first, then the cache.
+// The oldest entry drains into the cache whenever the cache is idle
+// and no store is entering; if it misses, its line is allocated like
+// a load miss. Dirty bits are kept per word, so only stored words are
+// written back when a line is replaced, one per cycle after dmem's
+// latency. Flush (end of a run) drains the buffer and writes back
+// every dirty word, then raises Flushed, so dmem holds all the stores
+// for +dmem_dump and +expect.
+
+module dcache #(parameter Sets = 16, Ways = 2, LineWords = 4, WBEntries = 4)
+   (input  logic        clk, reset,
+    // core side (Memory stage)
+    input  logic [31:0] Adr, WriteData,
+    input  logic        MemWrite, MemStrobe,
+    output logic [31:0] ReadData,
+    output logic        Ready,
+    input  logic        CoreReady,   // PCReady: the store really retires
+    input  logic        Flush,
+    output logic        Flushed,
+    // dmem side
+    output logic [31:0] MemAdr, MemWriteData,
+    output logic        MemWriteEn, MemReq,
+    input  logic [31:0] MemReadData,
+    input  logic        MemReady);
+
+   // performance counters: loads answered while the pipeline moved,
+   //   line refills, dirty lines written back and cycles the cache
+   //   held the pipeline
+   logic [31:0] Hits /*verilator public*/;
+   logic [31:0] Misses /*verilator public*/;
+   logic [31:0] Writebacks /*verilator public*/;
+   logic [31:0] StallCycles /*verilator public*/;
+   logic        load, store, miss, writeback;
+
+   assign load  = MemStrobe & ~MemWrite & ~Flush;
+   assign store = MemStrobe & MemWrite & ~Flush;
+
+   always_ff @(posedge clk, posedge reset)
+     if (reset)
+       begin
+          Hits        <= 0;
+          Misses      <= 0;
+          Writebacks  <= 0;
+          StallCycles <= 0;
+       end
+     else
+       begin
+          if (load & Ready & CoreReady) Hits        <= Hits + 1;
+          if (miss)                     Misses      <= Misses + 1;
+          if (writeback)                Writebacks  <= Writebacks + 1;
+          if (~Ready)                   StallCycles <= StallCycles + 1;
+       end
+
+   generate
+      if (Sets == 0)
+        begin
+           logic waiting;
+
+           assign MemAdr       = Adr;
+           assign MemWriteData = WriteData;
+           assign MemWriteEn   = MemWrite;
+           assign MemReq       = MemStrobe & ~Flush;
+           assign ReadData     = MemReadData;
+           assign Ready        = ~MemReq | MemReady;
+           assign Flushed      = 1'b1;
+
+           // an access that waits on dmem counts as one miss
+           assign miss      = MemReq & ~MemReady & ~waiting;
+           assign writeback = 1'b0;
+           always_ff @(posedge clk, posedge reset)
+             if (reset) waiting <= 1'b0;
+             else       waiting <= MemReq & ~MemReady;
+        end
+      else
+        begin
+           localparam OffBits  = $clog2(LineWords);
+           localparam SetBits  = $clog2(Sets);
+           localparam WayBits  = (Ways > 1) ? $clog2(Ways) : 1;
+           localparam TagLo    = OffBits + SetBits + 2;
+           localparam Lines    = Sets * Ways;
+           localparam LineBits = $clog2(Lines);
+           localparam WBBits   = $clog2(WBEntries + 1);
+
+           typedef enum logic [1:0] {IDLE, WRITEBACK, REFILL} statetype;
+
+           logic                valid[Lines-1:0];
+           logic [31:TagLo]     tag[Lines-1:0];
+           logic [31:0]         data[Lines*LineWords-1:0];
+           logic                dirty[Lines*LineWords-1:0];
+           logic [WayBits-1:0]  next[Sets-1:0];   // round-robin victim
+
+           // write buffer, oldest entry first
+           logic [31:2]         wbadr[WBEntries-1:0];
+           logic [31:0]         wbdata[WBEntries-1:0];
+           logic [WBBits-1:0]   wbcount;
+
+           statetype            state;
+           logic [LineBits-1:0] line;       // line being written back/refilled
+           logic [LineBits:0]   fline;      // next line for Flush to check
+           logic [LineBits:0]   vline;      // line a miss or Flush starts on
+           logic [31:OffBits+2] fill_adr, back_adr;
+           logic [OffBits-1:0]  word;
+           logic                fill;       // refill after the writeback
+
+           logic [31:0]         dadr, madr;
+           logic [SetBits-1:0]  set, dset, mset, vset;
+           logic [WayBits-1:0]  way, dway, victim;
+           logic                hit, dhit, wbmatch, vdirty, push, drain, walk;
+           int                  wbidx;
+
+           assign set  = Adr[TagLo-1:OffBits+2];
+           assign dadr = {wbadr[0], 2'b00};
+           assign dset = dadr[TagLo-1:OffBits+2];
+
+           // lookups: the core's address in the buffer and the cache,
+           //   and the oldest buffer entry in the cache
+           always_comb
+             begin
+                hit  = 1'b0;
+                way  = 0;
+                dhit = 1'b0;
+                dway = 0;
+                for (int w = 0; w < Ways; w++)
+                  begin
+                     if (valid[set*Ways + w] &&
+                         tag[set*Ways + w] == Adr[31:TagLo])
+                       begin
+                          hit = 1'b1;
+                          way = w;
+                       end
+                     if (valid[dset*Ways + w] &&
+                         tag[dset*Ways + w] == dadr[31:TagLo])
+                       begin
+                          dhit = 1'b1;
+                          dway = w;
+                       end
+                  end
+                wbmatch = 1'b0;
+                wbidx   = 0;
+                for (int i = 0; i < WBEntries; i++)
+                  if (i < wbcount && wbadr[i] == Adr[31:2])
+                    begin
+                       wbmatch = 1'b1;
+                       wbidx   = i;
+                    end
+             end
+
+           assign Ready = load  ? wbmatch | hit :
+                          store ? wbmatch | (wbcount < WBEntries) : 1'b1;
+           assign ReadData = wbmatch ? wbdata[wbidx] :
+                             data[(set*Ways + way)*LineWords + Adr[OffBits+1:2]];
+
+           // a store enters the buffer; the oldest entry drains on a
+           //   hit, else (or for a load that missed) a refill starts
+           assign push  = store & Ready & CoreReady;
+           assign miss  = (state == IDLE) &
+                          ((load & ~wbmatch & ~hit) | (wbcount != 0 & ~dhit));
+           assign drain = (state == IDLE) & (wbcount != 0) & dhit & ~push &
+                          ~(load & ~wbmatch & ~hit);
+           assign walk  = (state == IDLE) & Flush & (wbcount == 0) &
+                          (fline < Lines);
+           assign madr  = (load & ~wbmatch & ~hit) ? Adr : dadr;
+           assign mset  = madr[TagLo-1:OffBits+2];
+
+           // victim: an invalid way, else the set's round-robin way
+           always_comb
+             begin
+                victim = next[mset];
+                for (int w = Ways - 1; w >= 0; w--)
+                  if (!valid[mset*Ways + w])
+                    victim = w;
+             end
+
+           assign vline = miss ? (LineBits+1)'(mset*Ways + victim) : fline;
+           assign vset  = SetBits'(vline / Ways);
+           always_comb
+             begin
+                vdirty = 1'b0;
+                for (int k = 0; k < LineWords; k++)
+                  vdirty = vdirty | dirty[vline*LineWords + k];
+             end
+
+           assign writeback = (miss | walk) & valid[vline] & vdirty;
+           assign Flushed   = Flush & (state == IDLE) & (wbcount == 0) &
+                              (fline == Lines);
+
+           assign MemAdr       = {(state == REFILL) ? fill_adr : back_adr,
+                                  word, 2'b00};
+           assign MemWriteData = data[line*LineWords + word];
+           assign MemWriteEn   = (state == WRITEBACK);
+           assign MemReq       = (state == REFILL) |
+                                 (state == WRITEBACK) & dirty[line*LineWords + word];
+
+           always_ff @(posedge clk, posedge reset)
+             if (reset)
+               begin
+                  state   <= IDLE;
+                  wbcount <= 0;
+                  fline   <= 0;
+                  word    <= 0;
+                  for (int i = 0; i < Lines; i++)           valid[i] <= 1'b0;
+                  for (int i = 0; i < Lines*LineWords; i++) dirty[i] <= 1'b0;
+                  for (int i = 0; i < Sets; i++)            next[i]  <= 0;
+               end
+             else
+               begin
+                  // write buffer
+                  if (push)
+                    if (wbmatch)
+                      wbdata[wbidx] <= WriteData;
+                    else
+                      begin
+                         wbadr[wbcount]  <= Adr[31:2];
+                         wbdata[wbcount] <= WriteData;
+                      end
+                  if (drain)
+                    begin
+                       data[(dset*Ways + dway)*LineWords + dadr[OffBits+1:2]] <= wbdata[0];
+                       dirty[(dset*Ways + dway)*LineWords + dadr[OffBits+1:2]] <= 1'b1;
+                       for (int i = 0; i < WBEntries - 1; i++)
+                         begin
+                            wbadr[i]  <= wbadr[i+1];
+                            wbdata[i] <= wbdata[i+1];
+                         end
+                    end
+                  wbcount <= wbcount + (push & ~wbmatch) - drain;
+
+                  if (~Flush) fline <= 0;
+
+                  case (state)
+                    IDLE:
+                      if (miss | walk)
+                        begin
+                           line     <= vline[LineBits-1:0];
+                           back_adr <= {tag[vline], vset};
+                           fill_adr <= madr[31:OffBits+2];
+                           fill     <= miss;
+                           word     <= 0;
+                           if (valid[vline] & vdirty)
+                             state <= WRITEBACK;
+                           else if (miss)
+                             state <= REFILL;
+                           if (miss)
+                             begin
+                                valid[vline] <= 1'b0;
+                                if (victim == next[mset])
+                                  next[mset] <= (next[mset] == Ways - 1) ? 0 : next[mset] + 1'b1;
+                             end
+                           else
+                             fline <= fline + 1'b1;
+                        end
+                    WRITEBACK:
+                      if (~dirty[line*LineWords + word] | MemReady)
+                        begin
+                           dirty[line*LineWords + word] <= 1'b0;
+                           word <= word + 1'b1;
+                           if (word == LineWords - 1)
+                             state <= fill ? REFILL : IDLE;
+                        end
+                    REFILL:
+                      if (MemReady)
+                        begin
+                           data[line*LineWords + word] <= MemReadData;
+                           word <= word + 1'b1;
+                           if (word == LineWords - 1)
+                             begin
+                                state       <= IDLE;
+                                valid[line] <= 1'b1;
+                                tag[line]   <= fill_adr[31:TagLo];
+                             end
+                        end
+                    default:
+                      state <= IDLE;
+                  endcase
+               end
+        end
+   endgenerate
+
+endmodule // dcache
@@ -14,8 +14,8 @@ module dmem (mem_out, r_w, clk, mem_addr, mem_data, MStrobe, PCReady);
    input 	 clk;   
    input [31:0]  mem_addr;
    input [31:0]  mem_data;
-   input         MStrobe;
-   output        PCReady;
+   input         MStrobe;    // request
+   output        PCReady;    // ready: the read data is valid, the write lands
 
    // Choose smaller memory to speed simulation
    //   through smaller AddrSize (only used to
@@ -23,8 +23,17 @@ module dmem (mem_out, r_w, clk, mem_addr, mem_data, MStrobe, PCReady);
    //   32-bits)
    parameter AddrSize = 16;
    parameter WordSize = 8;
+   // Initial data, same format as imem.v; +dmem=file overrides it.
+   parameter MemFile = "";
+   // Timing of an access (MStrobe/PCReady), as in imem.v;
+   //   +dmem_timing= etc. at run time.
+   parameter Timing = 0;
+   parameter Latency = 0;
 
-   reg [WordSize-1:0] RAM[((1<<AddrSize)-1):0];   
+   reg [WordSize-1:0] RAM[((1<<AddrSize)-1):0] /*verilator public*/;
+
+   // Words loaded or written since time 0; dump writes only these
+   reg           touched[0:((1<<(AddrSize-2))-1)] /*verilator public*/;
 
    // Read memory
    //   byte addressed, but appears as 32b to processor
@@ -35,13 +44,73 @@ module dmem (mem_out, r_w, clk, mem_addr, mem_data, MStrobe, PCReady);
    // Write memory
    always @(posedge clk) 
    begin
-     if (r_w & MStrobe)
-       {RAM[mem_addr], RAM[mem_addr+1], 
-          RAM[mem_addr+2], RAM[mem_addr+3]} <= mem_data; 
+     if (r_w & MStrobe & PCReady)
+       begin
+         {RAM[mem_addr], RAM[mem_addr+1],
+            RAM[mem_addr+2], RAM[mem_addr+3]} <= mem_data;
+         touched[mem_addr[AddrSize-1:2]] <= 1'b1;
+         touched[(mem_addr[AddrSize-1:0] + 3) >> 2] <= 1'b1;
+       end
    end
 
-   assign PCReady = 1'b1;
+   // Timing: when a request is ready (see memlat.v)
+   memlat #(.Name("dmem"), .Timing(Timing), .Latency(Latency))
+          lat (.clk(clk), .req(MStrobe), .addr(mem_addr), .ready(PCReady));
 
-   
-endmodule // mem
+   // Load (see imem.v)
+   reg [8*256-1:0] file, line;
+   reg [31:0]    word;
+   integer       fd, w;
+
+   initial
+     begin
+        for (w = 0; w < (1<<(AddrSize-2)); w = w + 1)
+          touched[w] = 1'b0;
+        file = MemFile;
+        if ($value$plusargs("dmem=%s", file) || MemFile != "")
+          begin
+             fd = $fopen(file, "r");
+             if (fd == 0)
+               $display("dmem: can't open %0s", file);
+             else
+               begin
+                  w = 0;
+                  while ($fgets(line, fd))
+                    if ($sscanf(line, "@%h", word) == 1)
+                      w = word;
+                    else if ($sscanf(line, "%h", word) == 1 &&
+                             w < (1<<(AddrSize-2)))
+                      begin
+                         {RAM[4*w], RAM[4*w+1], RAM[4*w+2], RAM[4*w+3]} = word;
+                         touched[w] = 1'b1;
+                         w = w + 1;
+                      end
+                  $fclose(fd);
+               end
+          end
+     end
 
+   // Dump the touched words in the load format: runs of consecutive
+   //   words, each run after an "@index" line (byte address / 4), so
+   //   a dump is small and can be loaded back as +dmem=file.
+   task dump;
+      input [8*256-1:0] name;
+      integer prev;
+      begin
+         fd = $fopen(name, "w");
+         prev = -2;
+         $fwrite(fd, "// dmem: @ word index (byte address / 4), big-endian words\n");
+         for (w = 0; w < (1<<(AddrSize-2)); w = w + 1)
+           if (touched[w])
+             begin
+                if (w != prev + 1)
+                  $fwrite(fd, "@%0h\n", w);
+                $fwrite(fd, "%h%h%h%h\n", RAM[4*w], RAM[4*w+1],
+                        RAM[4*w+2], RAM[4*w+3]);
+                prev = w;
+             end
+         $fclose(fd);
+      end
+   endtask
+
+endmodule // mem
@@ -0,0 +1,146 @@
+//------------------------------------------------
+// icache.sv
+// Oklahoma State University
+// ECEN 4243
+// Instruction cache between imem and arm
+//------------------------------------------------
+//
+// Sets x Ways lines of LineWords words (Sets and LineWords powers of
+// two >= 2; Sets = 0 leaves fetch uncached, straight through to imem).
+// A fetch that hits is answered in the same cycle like imem; a miss
+// drops Ready, which top.sv ANDs into PCReady so the whole pipeline
+// holds (MemSysReady), while the refill FSM requests the line from
+// imem word by word (MemReq/MemReady, see imem.v for the latency) and
+// writes it into an invalid way, else the set's round-robin victim.
+// The fetch then hits and the pipeline moves on. A miss on a wrong-path
+// fetch is refilled too: the redirect waits in Execute until it is done.
+
+module icache #(parameter Sets = 16, Ways = 1, LineWords = 4)
+   (input  logic        clk, reset,
+    // core side
+    input  logic [31:0] PCF,
+    output logic [31:0] InstrF,
+    output logic        Ready,
+    input  logic        CoreReady,   // PCReady, for the counters
+    // imem side
+    output logic [31:0] MemAdr,
+    output logic        MemReq,
+    input  logic [31:0] MemData,
+    input  logic        MemReady);
+
+   // performance counters: fetch cycles that hit while the pipeline
+   //   moved, line refills, and cycles the cache held the pipeline
+   logic [31:0] Hits /*verilator public*/;
+   logic [31:0] Misses /*verilator public*/;
+   logic [31:0] StallCycles /*verilator public*/;
+   logic        refill;
+
+   always_ff @(posedge clk, posedge reset)
+     if (reset)
+       begin
+          Hits        <= 0;
+          Misses      <= 0;
+          StallCycles <= 0;
+       end
+     else
+       begin
+          if (Ready & CoreReady)   Hits        <= Hits + 1;
+          if (~Ready & ~refill)    Misses      <= Misses + 1;
+          if (~Ready)              StallCycles <= StallCycles + 1;
+       end
+
+   generate
+      if (Sets == 0)
+        begin
+           assign MemAdr = PCF;
+           assign MemReq = 1'b1;
+           assign InstrF = MemData;
+           assign Ready  = MemReady;
+
+           // a fetch that waits on imem counts as one miss
+           always_ff @(posedge clk, posedge reset)
+             if (reset) refill <= 1'b0;
+             else       refill <= ~MemReady;
+        end
+      else
+        begin
+           localparam OffBits = $clog2(LineWords);
+           localparam SetBits = $clog2(Sets);
+           localparam WayBits = (Ways > 1) ? $clog2(Ways) : 1;
+           localparam TagLo   = OffBits + SetBits + 2;
+
+           logic                valid[Sets*Ways-1:0];
+           logic [31:TagLo]     tag[Sets*Ways-1:0];
+           logic [31:0]         data[Sets*Ways*LineWords-1:0];
+           logic [WayBits-1:0]  next[Sets-1:0];   // round-robin victim
+
+           logic [SetBits-1:0]  set;
+           logic [OffBits-1:0]  off, word;
+           logic [WayBits-1:0]  hitway, victim, way;
+           logic                hit;
+
+           assign set = PCF[TagLo-1:OffBits+2];
+           assign off = PCF[OffBits+1:2];
+
+           // lookup (and the way to refill: an invalid one if any)
+           always_comb
+             begin
+                hit    = 1'b0;
+                hitway = 0;
+                victim = next[set];
+                for (int w = Ways - 1; w >= 0; w--)
+                  begin
+                     if (valid[set*Ways + w] &&
+                         tag[set*Ways + w] == PCF[31:TagLo])
+                       begin
+                          hit    = 1'b1;
+                          hitway = w;
+                       end
+                     if (!valid[set*Ways + w])
+                       victim = w;
+                  end
+             end
+
+           assign InstrF = data[(set*Ways + hitway)*LineWords + off];
+           assign Ready  = hit;
+           assign MemReq = refill;
+           assign MemAdr = {PCF[31:OffBits+2], word, 2'b00};
+
+           // refill FSM: idle, or fetching word "word" of the line
+           //   for PCF into "way"
+           always_ff @(posedge clk, posedge reset)
+             if (reset)
+               begin
+                  refill <= 1'b0;
+                  word   <= 0;
+                  way    <= 0;
+                  for (int i = 0; i < Sets*Ways; i++) valid[i] <= 1'b0;
+                  for (int i = 0; i < Sets; i++)      next[i]  <= 0;
+               end
+             else if (~refill)
+               begin
+                  if (~hit)
+                    begin
+                       refill                 <= 1'b1;
+                       word                   <= 0;
+                       way                    <= victim;
+                       valid[set*Ways+victim] <= 1'b0;
+                    end
+               end
+             else if (MemReady)
+               begin
+                  data[(set*Ways + way)*LineWords + word] <= MemData;
+                  word <= word + 1'b1;
+                  if (word == LineWords - 1)
+                    begin
+                       refill              <= 1'b0;
+                       valid[set*Ways+way] <= 1'b1;
+                       tag[set*Ways+way]   <= PCF[31:TagLo];
+                       if (way == next[set])
+                         next[set] <= (next[set] == Ways - 1) ? 0 : next[set] + 1'b1;
+                    end
+               end
+        end
+   endgenerate
+
+endmodule // icache
@@ -7,10 +7,13 @@
 // Harvard Architecture Instr Memory (Big Endian)
 //------------------------------------------------
 
-module imem (mem_addr, mem_out);
+module imem (mem_addr, mem_out, clk, req, ready);
 
    output [31:0] mem_out;
    input [31:0]  mem_addr;
+   input         clk;
+   input         req;
+   output        ready;
 
    // Choose smaller memory to speed simulation
    //   through smaller AddrSize (only used to
@@ -18,14 +21,82 @@ module imem (mem_addr, mem_out);
    //   32-bits)
    parameter AddrSize = 16;
    parameter WordSize = 8;
+   // Program image: one 32-bit big-endian word per line ($readmemh,
+   //   arm2hex .x or arm3hex -w), loaded from address 0.
+   //   +imem=file on the simulator command line overrides it.
+   parameter MemFile = "";
+   // Timing of a request (req/ready), see memlat.v: 0 fixed Latency
+   //   cycles (0 answers at once, like a RAM), 1 DRAM, 2 jitter;
+   //   +imem_timing= etc. override them at run time.
+   parameter Timing = 0;
+   parameter Latency = 0;
 
-   reg [WordSize-1:0] RAM[((1<<AddrSize)-1):0];   
+   reg [WordSize-1:0] RAM[((1<<AddrSize)-1):0] /*verilator public*/;
 
    // Read Instruction memory
    //   byte addressed, but appears as 32b to processor
    assign mem_out = {RAM[mem_addr], RAM[mem_addr+1],
                      RAM[mem_addr+2], RAM[mem_addr+3]};
 
-endmodule // imem
+   // Timing: when a request is ready (see memlat.v)
+   memlat #(.Name("imem"), .Timing(Timing), .Latency(Latency))
+          lat (.clk(clk), .req(req), .addr(mem_addr), .ready(ready));
+
+   // Load and dump. Images are $readmemh-style: one word per line,
+   //   "@index" (byte address / 4) to move on, other lines ignored.
+   //   Only the words an image defines are marked, so dumps stay
+   //   small (see dmem.v).
+   reg          loaded[0:((1<<(AddrSize-2))-1)];
+   reg [8*256-1:0] file, line;
+   reg [31:0]   word;
+   integer      fd, w;
 
+   initial
+     begin
+        for (w = 0; w < (1<<(AddrSize-2)); w = w + 1)
+          loaded[w] = 1'b0;
+        file = MemFile;
+        if ($value$plusargs("imem=%s", file) || MemFile != "")
+          begin
+             fd = $fopen(file, "r");
+             if (fd == 0)
+               $display("imem: can't open %0s", file);
+             else
+               begin
+                  w = 0;
+                  while ($fgets(line, fd))
+                    if ($sscanf(line, "@%h", word) == 1)
+                      w = word;
+                    else if ($sscanf(line, "%h", word) == 1 &&
+                             w < (1<<(AddrSize-2)))
+                      begin
+                         {RAM[4*w], RAM[4*w+1], RAM[4*w+2], RAM[4*w+3]} = word;
+                         loaded[w] = 1'b1;
+                         w = w + 1;
+                      end
+                  $fclose(fd);
+               end
+          end
+     end
 
+   task dump;
+      input [8*256-1:0] name;
+      integer prev;
+      begin
+         fd = $fopen(name, "w");
+         prev = -2;
+         $fwrite(fd, "// imem: @ word index (byte address / 4), big-endian words\n");
+         for (w = 0; w < (1<<(AddrSize-2)); w = w + 1)
+           if (loaded[w])
+             begin
+                if (w != prev + 1)
+                  $fwrite(fd, "@%0h\n", w);
+                $fwrite(fd, "%h%h%h%h\n", RAM[4*w], RAM[4*w+1],
+                        RAM[4*w+2], RAM[4*w+3]);
+                prev = w;
+             end
+         $fclose(fd);
+      end
+   endtask
+
+endmodule // imem
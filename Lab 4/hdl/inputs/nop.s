@@ -8,4 +8,5 @@ NOP
 NOP 
 AND R8, R1, R3
 ORR R9, R6, R1
-SUB R10, R1, R7
\ No newline at end of file
+SUB R10, R1, R7
+B .
\ No newline at end of file
@@ -0,0 +1,196 @@
+//------------------------------------------------
+// memlat.v
+// Oklahoma State University
+// ECEN 4243
+// Main-memory timing for imem.v and dmem.v
+//------------------------------------------------
+//
+// Decides when a request to imem or dmem is ready; the RAM itself is
+// still read and written in one cycle. A request (req) waits the
+// access latency, then ready goes high. While req stays high, the same
+// word or the next one in the row follows at one per cycle, as in a
+// burst. The timing is the Timing parameter, or at run time
+// +<Name>_timing=fixed|dram|jitter (Name is "imem" or "dmem"):
+//
+//   fixed    every access waits Latency cycles (+<Name>_latency=n)
+//   dram     Banks banks of RowWords-word rows, consecutive rows in
+//            consecutive banks, each bank keeping its last row open.
+//            A row hit waits tCAS, a closed bank tRCD + tCAS, a row
+//            conflict tRP + tRCD + tCAS, and a bank activated less than
+//            tRC cycles before must first wait out the rest of tRC
+//            (+<Name>_tcas=n, _trcd=n, _trp=n, _trc=n)
+//   jitter   Latency plus 0 to Jitter cycles from a xorshift generator,
+//            so runs repeat, in either simulator, for the same seed
+//            (+<Name>_jitter=n, +<Name>_seed=n)
+//
+// The counters (printed by tb.sv and sim_main.cpp) give accesses
+// (bursts), row hits and conflicts, accesses delayed by a busy bank,
+// and the cycles requests spent waiting.
+
+module memlat (clk, req, addr, ready);
+
+   input        clk;
+   input        req;
+   input [31:0] addr;
+   output       ready;
+
+   parameter Name     = "mem";   // plusarg prefix
+   parameter Timing   = 0;       // 0 fixed, 1 dram, 2 jitter
+   parameter Latency  = 10;
+   parameter Jitter   = 8;
+   parameter Banks    = 4;
+   parameter RowWords = 256;
+   parameter tCAS     = 4;
+   parameter tRCD     = 6;
+   parameter tRP      = 6;
+   parameter tRC      = 20;
+
+   reg [31:0]   Accesses /*verilator public*/;
+   reg [31:0]   RowHits /*verilator public*/;
+   reg [31:0]   RowConflicts /*verilator public*/;
+   reg [31:0]   BankBusy /*verilator public*/;
+   reg [31:0]   WaitCycles /*verilator public*/;
+
+   // run-time settings
+   integer      timing, latency, jitter, cas, rcd, rp, rc;
+   reg [8*8-1:0] mode;
+
+   // bank state (dram) and generator state (jitter)
+   reg          open[0:Banks-1];
+   integer      open_row[0:Banks-1];
+   integer      act_at[0:Banks-1];
+   reg [31:0]   rnd;
+
+   // the access in progress
+   reg [31:0]   last_addr;
+   reg          burst, active;
+   integer      waited, need, now;
+
+   // latency of an access starting at addr this cycle
+   integer      b, r, busy, lat;
+   reg          rowhit, cont;
+   integer      k;
+
+   function [31:0] xorshift;
+      input [31:0] x;
+      reg [31:0]   y;
+      begin
+         y = x ^ (x << 13);
+         y = y ^ (y >> 17);
+         xorshift = y ^ (y << 5);
+      end
+   endfunction
+
+   always @(*)
+     begin
+        b      = (addr[31:2] / RowWords) % Banks;
+        r      = addr[31:2] / (RowWords * Banks);
+        rowhit = open[b] && open_row[b] == r;
+        busy   = 0;
+        if (timing == 1)
+          if (rowhit)
+            lat = cas;
+          else
+            begin
+               if (now < act_at[b] + rc)
+                 busy = act_at[b] + rc - now;
+               lat = busy + (open[b] ? rp : 0) + rcd + cas;
+            end
+        else if (timing == 2)
+          lat = latency + rnd % (jitter + 1);
+        else
+          lat = latency;
+        cont = burst && (addr == last_addr ||
+                         addr == last_addr + 4 && addr[31:2] % RowWords != 0);
+     end
+
+   assign ready = req & (cont || (active ? waited >= need : lat == 0));
+
+   always @(posedge clk)
+     begin
+        now <= now + 1;
+        if (req && !active && !cont)
+          begin
+             Accesses <= Accesses + 1;
+             if (timing == 1)
+               if (rowhit)
+                 RowHits <= RowHits + 1;
+               else
+                 begin
+                    if (open[b])  RowConflicts <= RowConflicts + 1;
+                    if (busy > 0) BankBusy     <= BankBusy + 1;
+                    open[b]     <= 1'b1;
+                    open_row[b] <= r;
+                    act_at[b]   <= now + busy + (open[b] ? rp : 0);
+                 end
+             if (timing == 2)
+               rnd <= xorshift(rnd);
+          end
+        if (req & ~ready)
+          WaitCycles <= WaitCycles + 1;
+        if (req & ready)
+          begin
+             burst     <= 1'b1;
+             last_addr <= addr;
+             active    <= 1'b0;
+             waited    <= 0;
+          end
+        else if (req)
+          begin
+             burst  <= 1'b0;
+             active <= 1'b1;
+             need   <= active ? need : lat;
+             waited <= waited + 1;
+          end
+        else
+          begin
+             burst  <= 1'b0;
+             active <= 1'b0;
+             waited <= 0;
+          end
+     end
+
+   initial
+     begin
+        timing = Timing;
+        latency = Latency;
+        jitter = Jitter;
+        cas = tCAS;
+        rcd = tRCD;
+        rp = tRP;
+        rc = tRC;
+        rnd = 32'h2545F491;
+        if ($value$plusargs({Name, "_timing=%s"}, mode))
+          if (mode == "fixed")
+            timing = 0;
+          else if (mode == "dram")
+            timing = 1;
+          else if (mode == "jitter")
+            timing = 2;
+          else
+            $display("%0s: unknown timing %0s, using fixed", Name, mode);
+        if ($value$plusargs({Name, "_latency=%d"}, latency)) ;
+        if ($value$plusargs({Name, "_jitter=%d"}, jitter)) ;
+        if ($value$plusargs({Name, "_tcas=%d"}, cas)) ;
+        if ($value$plusargs({Name, "_trcd=%d"}, rcd)) ;
+        if ($value$plusargs({Name, "_trp=%d"}, rp)) ;
+        if ($value$plusargs({Name, "_trc=%d"}, rc)) ;
+        if ($value$plusargs({Name, "_seed=%d"}, rnd) && rnd == 0)
+          rnd = 1;   // xorshift sticks at 0
+        Accesses = 0;
+        RowHits = 0;
+        RowConflicts = 0;
+        BankBusy = 0;
+        WaitCycles = 0;
+        burst = 1'b0;
+        active = 1'b0;
+        waited = 0;
+        now = 0;
+        for (k = 0; k < Banks; k = k + 1)
+          begin
+             open[k] = 1'b0;
+             act_at[k] = -(1 << 30);
+          end
+     end
+
+endmodule // memlat
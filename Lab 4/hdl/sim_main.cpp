@@ -0,0 +1,493 @@
+//------------------------------------------------
+// sim_main.cpp
+// Oklahoma State University
+// ECEN 4243
+// Verilator driver for top (arm_pipelined.sv),
+// used in place of tb.sv
+//------------------------------------------------
+//
+// Usage: obj_dir/Vtop [-max cycles] [-fst file] [-dump file]
+//                     [-expect file] [-cosim] [+plusargs] program
+//
+// Plusargs go to the RTL as in ModelSim, e.g. +dmem_timing=dram for
+// the memory timing (memlat.v).
+//
+// The program is one 32-bit word per line (memfile.dat, arm2hex .x,
+// "@index" lines as in imem.v) or the older one byte per line; either
+// way it is stored big-endian straight into imem.RAM. Reset is
+// held for two cycles as in tb.sv, then the core is clocked until it
+// halts: top.Halt ("b ." retired or a store to HaltAdr), or, for
+// programs without a halt, fetch has been past the end of the image for
+// longer than any branch takes to come back. The register file and the
+// simulation speed are printed at the end, then Flush writes the data
+// cache back into dmem; -dump writes the dmem words
+// the program stored in the dmem.v dump format, and -expect checks an
+// expected-results file (format in tb.sv) and prints PASS/FAIL, with
+// the exit status to match.
+//
+// -cosim (make COSIM=1) runs the Lab 2 ISS in lock-step as the
+// reference. Every time an instruction leaves Writeback (ValidW, so not
+// a bubble) the ISS executes one instruction, and after the register
+// file write (RegWriteW to RA3D/RA4D, i.e. WA3W/ResultW or LR for BL)
+// the PC, instruction word, R0-R14 and any store the instruction made
+// from Memory are compared. The first mismatch stops the run with both
+// states dumped. The ISS has text at 0 so addresses line up and, like
+// imem and dmem, keeps text and data apart: the program goes into text
+// only, data starts zeroed, and stores never reach the code.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "Vtop.h"
+#include "Vtop___024root.h"
+#include "verilated.h"
+#if VM_TRACE
+#include "verilated_fst_c.h"
+#endif
+#ifdef COSIM
+#include "../../Lab 2/src/armsim.h"
+#endif
+
+#define RESET_CYCLES 2
+#define DRAIN_CYCLES 8   // > the 4 cycles a taken branch needs
+#define FLUSH_CYCLES (1 << 20)   // bound on the dcache write-back
+#define MEM_BYTES    (1 << 16)
+
+static std::vector<uint8_t> load_image (const char *file) {
+
+  std::vector<uint8_t> image;
+  size_t at = 0;
+  char line[256];
+  FILE *in = fopen(file, "r");
+
+  if (in == NULL) {
+    printf("Error: Can't open program file %s\n", file);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), in) != NULL) {
+    char *p = line, *end;
+    unsigned long v;
+
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (p[0] == '/' && p[1] == '/')
+      continue;
+    if (p[0] == '@') {
+      at = 4 * strtoul(p + 1, NULL, 16);
+      continue;
+    }
+    v = strtoul(p, &end, 16);
+    if (end == p)
+      continue;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+      p += 2;
+    int n = end - p <= 2 ? 1 : 4;
+
+    if (at + n > MEM_BYTES) {
+      at = MEM_BYTES + 1;
+      break;
+    }
+    if (image.size() < at + n)
+      image.resize(at + n);
+    if (n == 1) {
+      image[at++] = v;
+    } else {
+      image[at++] = v >> 24;
+      image[at++] = v >> 16;
+      image[at++] = v >> 8;
+      image[at++] = v;
+    }
+  }
+  fclose(in);
+  if (at > MEM_BYTES) {
+    printf("Error: %s is larger than imem (%d bytes)\n", file, MEM_BYTES);
+    exit(1);
+  }
+  return image;
+}
+
+// Words the program stored, as dmem.v's dump task writes them.
+static void dump_dmem (Vtop___024root *root, const char *file) {
+
+  FILE *out = fopen(file, "w");
+  int w, prev = -2;
+
+  if (out == NULL) {
+    printf("Error: Can't open dump file %s\n", file);
+    return;
+  }
+  fprintf(out, "// dmem: @ word index (byte address / 4), big-endian words\n");
+  for (w = 0; w < MEM_BYTES / 4; w++)
+    if (root->top__DOT__dmem__DOT__touched[w]) {
+      if (w != prev + 1)
+        fprintf(out, "@%x\n", w);
+      fprintf(out, "%02x%02x%02x%02x\n",
+              root->top__DOT__dmem__DOT__RAM[4 * w],
+              root->top__DOT__dmem__DOT__RAM[4 * w + 1],
+              root->top__DOT__dmem__DOT__RAM[4 * w + 2],
+              root->top__DOT__dmem__DOT__RAM[4 * w + 3]);
+      prev = w;
+    }
+  fclose(out);
+}
+
+// Checks the r<n>/mem lines of an expected-results file; returns the
+// number of mismatches.
+static int check_expected (Vtop___024root *root, const char *file) {
+
+  char line[256];
+  unsigned addr, want, got;
+  int n, errors = 0;
+  FILE *in = fopen(file, "r");
+
+  if (in == NULL) {
+    printf("Error: Can't open expected-results file %s\n", file);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), in) != NULL) {
+    if (sscanf(line, " r%d %x", &n, &want) == 2 && n >= 0 && n < 15) {
+      got = root->top__DOT__arm__DOT__dp__DOT__rf__DOT__rf[n];
+      if (got != want) {
+        printf("  R%d = 0x%08x, expected 0x%08x\n", n, got, want);
+        errors++;
+      }
+    } else if (sscanf(line, " mem %x %x", &addr, &want) == 2 &&
+               addr <= MEM_BYTES - 4) {
+      got = root->top__DOT__dmem__DOT__RAM[addr] << 24 |
+            root->top__DOT__dmem__DOT__RAM[addr + 1] << 16 |
+            root->top__DOT__dmem__DOT__RAM[addr + 2] << 8 |
+            root->top__DOT__dmem__DOT__RAM[addr + 3];
+      if (got != want) {
+        printf("  mem[0x%08x] = 0x%08x, expected 0x%08x\n", addr, got, want);
+        errors++;
+      }
+    }
+  }
+  fclose(in);
+  return errors;
+}
+
+// The core's performance counters (arm.Cycles/Retired, btb, ras) and
+// the caches'.
+static void print_counters (Vtop___024root *root) {
+
+  unsigned cyc = root->top__DOT__arm__DOT__Cycles;
+  unsigned ret = root->top__DOT__arm__DOT__Retired;
+  unsigned br = root->top__DOT__arm__DOT__dp__DOT__bp__DOT__Branches;
+  unsigned mis = root->top__DOT__arm__DOT__dp__DOT__bp__DOT__Mispredicts;
+  unsigned rets = root->top__DOT__arm__DOT__dp__DOT__rs__DOT__Returns;
+  unsigned rmis = root->top__DOT__arm__DOT__dp__DOT__rs__DOT__ReturnMispredicts;
+  unsigned ih = root->top__DOT__icache__DOT__Hits;
+  unsigned im = root->top__DOT__icache__DOT__Misses;
+  unsigned is = root->top__DOT__icache__DOT__StallCycles;
+
+  printf("%u instructions in %u cycles, CPI %.3f\n", ret, cyc,
+         ret ? (double)cyc / ret : 0.0);
+  printf("%u branches, %u mispredicted (%.2f%% correct)\n", br, mis,
+         br ? 100.0 * (br - mis) / br : 0.0);
+  printf("%u returns, %u mispredicted\n", rets, rmis);
+  printf("icache: %u hits, %u misses (%.2f%% hit), %u stall cycles\n", ih, im,
+         ih + im ? 100.0 * ih / (ih + im) : 0.0, is);
+  printf("dcache: %u load hits, %u misses, %u writebacks, %u stall cycles\n",
+         root->top__DOT__dcache__DOT__Hits, root->top__DOT__dcache__DOT__Misses,
+         root->top__DOT__dcache__DOT__Writebacks,
+         root->top__DOT__dcache__DOT__StallCycles);
+  printf("imem: %u accesses, %u row hits, %u row conflicts, %u bank busy,"
+         " %u wait cycles\n",
+         root->top__DOT__imem__DOT__lat__DOT__Accesses,
+         root->top__DOT__imem__DOT__lat__DOT__RowHits,
+         root->top__DOT__imem__DOT__lat__DOT__RowConflicts,
+         root->top__DOT__imem__DOT__lat__DOT__BankBusy,
+         root->top__DOT__imem__DOT__lat__DOT__WaitCycles);
+  printf("dmem: %u accesses, %u row hits, %u row conflicts, %u bank busy,"
+         " %u wait cycles\n",
+         root->top__DOT__dmem__DOT__lat__DOT__Accesses,
+         root->top__DOT__dmem__DOT__lat__DOT__RowHits,
+         root->top__DOT__dmem__DOT__lat__DOT__RowConflicts,
+         root->top__DOT__dmem__DOT__lat__DOT__BankBusy,
+         root->top__DOT__dmem__DOT__lat__DOT__WaitCycles);
+}
+
+#ifdef COSIM
+static int cond_passed (uint32_t cpsr, uint32_t cond) {
+
+  int n = (cpsr >> 31) & 1, z = (cpsr >> 30) & 1;
+  int c = (cpsr >> 29) & 1, v = (cpsr >> 28) & 1;
+
+  switch (cond) {
+  case 0x0: return z;
+  case 0x1: return !z;
+  case 0x2: return c;
+  case 0x3: return !c;
+  case 0x4: return n;
+  case 0x5: return !n;
+  case 0x6: return v;
+  case 0x7: return !v;
+  case 0x8: return c && !z;
+  case 0x9: return !c || z;
+  case 0xA: return n == v;
+  case 0xB: return n != v;
+  case 0xC: return !z && n == v;
+  case 0xD: return z || n != v;
+  default:  return 1;
+  }
+}
+
+// The ISS's instruction word at pc: from its text memory, which its
+// data region shadows for armsim_read_word (see main).
+static uint32_t iss_fetch (armsim_t *iss, uint32_t pc) {
+
+  uint32_t len;
+  const uint8_t *p = armsim_read_mem(iss, pc, &len);
+
+  if (p == NULL || len < 4)
+    return 0;
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// One retirement from Writeback checked against one ISS step; prints
+// both states and returns false on a mismatch.
+static bool cosim_check (Vtop___024root *root, armsim_t *iss,
+                         unsigned long long cycle, unsigned long long seq,
+                         bool stored, uint32_t st_addr, uint32_t st_data) {
+
+  uint32_t instr = root->top__DOT__arm__DOT__InstrW;
+  uint32_t pc = root->top__DOT__arm__DOT__dp__DOT__PCPlus4W - 4;
+  uint32_t iss_pc = armsim_read_reg(iss, 15);
+  uint32_t iss_word = iss_fetch(iss, iss_pc);
+  bool iss_store = ((iss_word >> 26) & 3) == 1 && !((iss_word >> 20) & 1) &&
+                   cond_passed(armsim_read_reg(iss, ARMSIM_CPSR), iss_word >> 28);
+  const char *why = NULL;
+  int r;
+
+  if (iss_pc != pc)
+    why = "PC";
+  else if (iss_word != instr)
+    why = "instruction word";
+  if (why == NULL) {
+    armsim_step_n(iss, 1);
+    for (r = 0; r < 15 && why == NULL; r++)
+      if (armsim_read_reg(iss, r) !=
+          root->top__DOT__arm__DOT__dp__DOT__rf__DOT__rf[r])
+        why = "register file";
+    if (why == NULL && stored != iss_store)
+      why = stored ? "store (ISS did not store)" : "store (RTL did not store)";
+    if (why == NULL && stored && armsim_read_word(iss, st_addr) != st_data)
+      why = "store data";
+  }
+  if (why == NULL)
+    return true;
+
+  printf("Co-simulation mismatch in %s at cycle %llu, instruction %llu\n",
+         why, cycle, seq);
+  printf("  RTL: PC 0x%08x  %08x", pc, instr);
+  if (root->top__DOT__arm__DOT__RegWriteW)
+    printf("  R%d <= 0x%08x", root->top__DOT__arm__DOT__dp__DOT__RA3D,
+           (unsigned)root->top__DOT__arm__DOT__dp__DOT__RA4D);
+  if (stored)
+    printf("  mem[0x%08x] <= 0x%08x", st_addr, st_data);
+  printf("\n  ISS: PC 0x%08x  %08x  CPSR 0x%08x\n", iss_pc, iss_word,
+         armsim_read_reg(iss, ARMSIM_CPSR));
+  if (stored)
+    printf("       mem[0x%08x] = 0x%08x\n", st_addr,
+           armsim_read_word(iss, st_addr));
+  printf("         RTL         ISS\n");
+  for (r = 0; r < 15; r++) {
+    uint32_t a = root->top__DOT__arm__DOT__dp__DOT__rf__DOT__rf[r];
+    uint32_t b = armsim_read_reg(iss, r);
+    printf("  R%-2d  0x%08x  0x%08x%s\n", r, a, b, a != b ? "  *" : "");
+  }
+  return false;
+}
+#endif
+
+int main (int argc, char **argv) {
+
+  const char *program = NULL, *fst_file = NULL, *dump_file = NULL;
+  const char *expect_file = NULL;
+  unsigned long long max_cycles = 1000000, cycles = 0;
+  unsigned long long ticks = 0;
+  int arg, outside = 0, errors = 0;
+  bool cosim = false, halted = false;
+
+  Verilated::commandArgs(argc, argv);
+  for (arg = 1; arg < argc; arg++) {
+    if (!strcmp(argv[arg], "-max") && arg + 1 < argc)
+      max_cycles = strtoull(argv[++arg], NULL, 0);
+    else if (!strcmp(argv[arg], "-fst") && arg + 1 < argc)
+      fst_file = argv[++arg];
+    else if (!strcmp(argv[arg], "-dump") && arg + 1 < argc)
+      dump_file = argv[++arg];
+    else if (!strcmp(argv[arg], "-expect") && arg + 1 < argc)
+      expect_file = argv[++arg];
+    else if (!strcmp(argv[arg], "-cosim"))
+      cosim = true;
+    else if (argv[arg][0] != '+')
+      program = argv[arg];
+  }
+  if (program == NULL) {
+    printf("Error: usage: %s [-max cycles] [-fst file] [-dump file]"
+           " [-expect file] [-cosim] [+plusargs] program\n", argv[0]);
+    return 1;
+  }
+
+  Vtop *top = new Vtop;
+  Vtop___024root *root = top->rootp;
+  std::vector<uint8_t> image = load_image(program);
+
+  for (size_t k = 0; k < image.size(); k++)
+    root->top__DOT__imem__DOT__RAM[k] = image[k];
+
+#ifdef COSIM
+  armsim_t *iss = NULL;
+  unsigned long long retired = 0;
+  if (cosim) {
+    // separate text and data at the same addresses, like imem and dmem
+    armsim_set_region("text", 0, MEM_BYTES);
+    armsim_set_region("data", 0, MEM_BYTES);
+    iss = armsim_create();
+    armsim_load_image(iss, 0, image.data(), image.size());
+  }
+#else
+  if (cosim) {
+    printf("Error: built without co-simulation (make COSIM=1)\n");
+    return 1;
+  }
+#endif
+
+#if VM_TRACE
+  VerilatedFstC *fst = NULL;
+  if (fst_file != NULL) {
+    Verilated::traceEverOn(true);
+    fst = new VerilatedFstC;
+    top->trace(fst, 99);
+    fst->open(fst_file);
+  }
+#else
+  if (fst_file != NULL)
+    printf("Warning: built without tracing (make TRACE=1), -fst ignored\n");
+#endif
+
+  auto start = std::chrono::steady_clock::now();
+
+  top->reset = 1;
+  while (cycles < max_cycles && !Verilated::gotFinish()) {
+    if (cycles == RESET_CYCLES)
+      top->reset = 0;
+    // sampled before the edge that commits the halting store
+    bool halt = cycles > RESET_CYCLES && root->top__DOT__Halt;
+#ifdef COSIM
+    // what the posedge commits: a store from Memory, a move into Writeback
+    bool ready = root->top__DOT__PCReady && !top->reset;
+    bool stored = ready && top->MemWrite && root->top__DOT__MStrobe;
+    uint32_t st_addr = top->DataAdr, st_data = top->WriteData;
+#endif
+    top->clk = 1;
+    top->eval();
+#if VM_TRACE
+    if (fst)
+      fst->dump(ticks);
+#endif
+    ticks += 5;
+    top->clk = 0;
+    top->eval();
+#if VM_TRACE
+    if (fst)
+      fst->dump(ticks);
+#endif
+    ticks += 5;
+    cycles++;
+
+#ifdef COSIM
+    // after the negedge, so the register file holds the writeback
+    if (iss != NULL && ready && root->top__DOT__arm__DOT__ValidW) {
+      if (armsim_halted(iss)) {
+        printf("ISS halted (swi) after %llu instructions\n", retired);
+        halted = true;
+        break;
+      }
+      if (!cosim_check(root, iss, cycles, retired, stored, st_addr, st_data)) {
+        top->final();
+        return 1;
+      }
+      retired++;
+    }
+#endif
+
+    if (halt) {
+      halted = true;
+      break;
+    }
+    // counted only while the pipeline moves, not during a refill
+    if (cycles > RESET_CYCLES && root->top__DOT__PC >= image.size()) {
+      if (root->top__DOT__PCReady && ++outside > DRAIN_CYCLES) {
+        halted = true;
+        break;
+      }
+    } else {
+      outside = 0;
+    }
+  }
+
+  double secs = std::chrono::duration<double>(
+                  std::chrono::steady_clock::now() - start).count();
+
+  if (halted) {
+    printf("Halted after %llu cycles\n", cycles);
+  } else {
+    printf("Stopped after %llu cycles (-max) without a halt\n", cycles);
+    errors++;
+  }
+  for (int r = 0; r < 15; r++)
+    printf("R%-2d = 0x%08x%s", r,
+           (unsigned)root->top__DOT__arm__DOT__dp__DOT__rf__DOT__rf[r],
+           r % 4 == 3 ? "\n" : "   ");
+  printf("PC  = 0x%08x\n", (unsigned)root->top__DOT__PC);
+  print_counters(root);
+  printf("Simulated %llu cycles in %.3f s (%.0f cycles/s)\n", cycles, secs,
+         secs > 0 ? cycles / secs : 0.0);
+
+  // write the data cache back so dmem holds every store (after the
+  // counters, which these cycles would skew)
+  top->Flush = 1;
+  for (int k = 0; !root->top__DOT__Flushed && k < FLUSH_CYCLES; k++) {
+    top->clk = 1;
+    top->eval();
+    top->clk = 0;
+    top->eval();
+  }
+  if (!root->top__DOT__Flushed) {
+    printf("Error: data cache not written back after %d cycles\n",
+           FLUSH_CYCLES);
+    errors++;
+  }
+
+  top->final();
+#if VM_TRACE
+  if (fst) {
+    fst->close();
+    delete fst;
+  }
+#endif
+  if (dump_file != NULL)
+    dump_dmem(root, dump_file);
+  if (expect_file != NULL) {
+    errors += check_expected(root, expect_file);
+    if (errors == 0)
+      printf("PASS: %s halted after %llu cycles\n", program, cycles);
+    else
+      printf("FAIL: %s, %d error(s), %llu cycles\n", program, errors, cycles);
+  }
+#ifdef COSIM
+  if (iss != NULL) {
+    printf("Co-simulation: %llu instructions matched the ISS\n", retired);
+    armsim_destroy(iss);
+  }
+#endif
+
+  delete top;
+  return expect_file != NULL && errors != 0;
+}
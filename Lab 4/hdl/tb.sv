@@ -13,14 +13,15 @@ module testbench();
    logic        reset;
 
    logic [31:0] WriteData, DataAdr;
-   logic        MemWrite;
+   logic        MemWrite, Flush;
 
    // instantiate device to be tested
-   top dut (clk, reset, WriteData, DataAdr, MemWrite);
+   top dut (clk, reset, WriteData, DataAdr, MemWrite, Flush);
    
    // initialize test
    initial
      begin
+    Flush <= 0;
     reset <= 1; # 22; reset <= 0;
      end
 
@@ -30,4 +31,111 @@ module testbench();
     clk <= 1; # 5; clk <= 0; # 5;
      end
 
+   // End of test: stop when dut.Halt (see top.sv), when fetch has
+   //   been outside the loaded program for longer than a taken branch
+   //   takes to come back (programs without a halt), or after
+   //   +cycles=n clocks (default 100000). Then print the counters,
+   //   Flush the data cache into dmem, check +expect=file,
+   //   write the touched memory words (+dmem_dump=file,
+   //   +imem_dump=file) and print PASS/FAIL with the cycle count.
+   //
+   // Expected-results file, one check per line, "//" comments:
+   //   r<n> <hex>          register n (0-14)
+   //   mem <addr> <hex>    big-endian word at byte address addr (hex)
+   integer         cycles, max_cycles, outside, errors;
+   reg [8*256-1:0] dump_file, expect_file;
+   reg             halted;
+
+   task check_expected;
+      input [8*256-1:0] name;
+      reg [8*256-1:0] line;
+      reg [31:0]      addr, want, got;
+      integer         fd, n;
+      begin
+         fd = $fopen(name, "r");
+         if (fd == 0)
+           begin
+              $display("Error: can't open %0s", name);
+              errors = errors + 1;
+           end
+         else
+           begin
+              while ($fgets(line, fd))
+                if ($sscanf(line, "r%d %h", n, want) == 2)
+                  begin
+                     got = dut.arm.dp.rf.rf[n];
+                     if (got !== want)
+                       begin
+                          $display("  R%0d = 0x%h, expected 0x%h", n, got, want);
+                          errors = errors + 1;
+                       end
+                  end
+                else if ($sscanf(line, "mem %h %h", addr, want) == 2)
+                  begin
+                     got = {dut.dmem.RAM[addr], dut.dmem.RAM[addr+1],
+                            dut.dmem.RAM[addr+2], dut.dmem.RAM[addr+3]};
+                     if (got !== want)
+                       begin
+                          $display("  mem[0x%h] = 0x%h, expected 0x%h",
+                                   addr, got, want);
+                          errors = errors + 1;
+                       end
+                  end
+              $fclose(fd);
+           end
+      end
+   endtask
+
+   initial
+     begin
+    if (!$value$plusargs("cycles=%d", max_cycles)) max_cycles = 100000;
+    cycles = 0; outside = 0; errors = 0; halted = 0;
+    @(negedge reset);
+    while (!halted && cycles < max_cycles)
+      begin
+         @(posedge clk);
+         cycles = cycles + 1;
+         if (dut.imem.loaded[dut.PC[15:2]] && dut.PC < 32'h10000)
+           outside = 0;
+         else if (dut.PCReady)   // not while a refill holds the pipe
+           outside = outside + 1;
+         halted = dut.Halt || outside > 8;
+      end
+    #1;   // let the last store land
+    if (!halted)
+      begin
+         $display("Stopped after %0d cycles (+cycles) without a halt", cycles);
+         errors = errors + 1;
+      end
+    $display("%0d instructions in %0d cycles, CPI %0.3f; %0d branches, %0d mispredicted; %0d returns, %0d mispredicted",
+             dut.arm.Retired, dut.arm.Cycles,
+             dut.arm.Cycles / (dut.arm.Retired + 0.0),
+             dut.arm.dp.bp.Branches, dut.arm.dp.bp.Mispredicts,
+             dut.arm.dp.rs.Returns, dut.arm.dp.rs.ReturnMispredicts);
+    $display("icache: %0d hits, %0d misses, %0d stall cycles",
+             dut.icache.Hits, dut.icache.Misses, dut.icache.StallCycles);
+    $display("dcache: %0d load hits, %0d misses, %0d writebacks, %0d stall cycles",
+             dut.dcache.Hits, dut.dcache.Misses, dut.dcache.Writebacks,
+             dut.dcache.StallCycles);
+    $display("imem: %0d accesses, %0d row hits, %0d row conflicts, %0d bank busy, %0d wait cycles",
+             dut.imem.lat.Accesses, dut.imem.lat.RowHits,
+             dut.imem.lat.RowConflicts, dut.imem.lat.BankBusy,
+             dut.imem.lat.WaitCycles);
+    $display("dmem: %0d accesses, %0d row hits, %0d row conflicts, %0d bank busy, %0d wait cycles",
+             dut.dmem.lat.Accesses, dut.dmem.lat.RowHits,
+             dut.dmem.lat.RowConflicts, dut.dmem.lat.BankBusy,
+             dut.dmem.lat.WaitCycles);
+    Flush = 1;
+    while (!dut.Flushed) @(posedge clk);
+    #1;
+    if ($value$plusargs("expect=%s", expect_file)) check_expected(expect_file);
+    if ($value$plusargs("dmem_dump=%s", dump_file)) dut.dmem.dump(dump_file);
+    if ($value$plusargs("imem_dump=%s", dump_file)) dut.imem.dump(dump_file);
+    if (errors == 0)
+      $display("PASS: halted after %0d cycles", cycles);
+    else
+      $display("FAIL: %0d error(s), %0d cycles", errors, cycles);
+    $finish;
+     end
+
 endmodule // testbench
@@ -5,15 +5,51 @@
  * swapped into the Vivado project and things should "just werk".
  */
 
-module top (input  logic        clk, reset, 
+module top #(parameter BTBEntries = 16,          // see btb in arm_pipelined.sv
+             parameter RASDepth   = 4,           // see ras
+             parameter ICacheSets = 16,          // see icache.sv
+             parameter ICacheWays = 1,
+             parameter ICacheLineWords = 4,
+             parameter IMemTiming = 0,           // see memlat.v
+             parameter IMemLatency = 10,
+             parameter DCacheSets = 16,          // see dcache.sv
+             parameter DCacheWays = 2,
+             parameter DCacheLineWords = 4,
+             parameter WBEntries = 4,
+             parameter DMemTiming = 0,
+             parameter DMemLatency = 10,
+             parameter HaltAdr    = 32'h0000FFFC)
+           (input  logic        clk, reset, 
             output logic [31:0] WriteData, DataAdr, 
-            output logic        MemWrite);
+            output logic        MemWrite,
+            input  logic        Flush);
 
-   logic [31:0] PC, Instr, ReadData;
-   logic        PCReady, MStrobe;
-   
-   // instantiate processor and memories
-   arm arm (.clk(clk),
+   logic [31:0] PC /*verilator public*/;
+   logic [31:0] Instr, ReadData;
+   logic [31:0] IMemAdr, IMemData;
+   logic        IMemReq, IMemReady, IReady, DReady;
+   logic [31:0] DMemAdr, DMemWriteData, DMemReadData;
+   logic        DMemWrite, DMemReq, DMemReady;
+   logic        Flushed /*verilator public*/;
+   logic        PCReady /*verilator public*/;
+   logic        MStrobe /*verilator public*/;
+   logic        Halt /*verilator public*/;
+
+   // Halt convention for tb.sv and sim_main.cpp: "b ." (EAFFFFFE)
+   //   leaving Writeback, or a store to HaltAdr (the value stored is
+   //   left in dmem as an exit code). Either way every older
+   //   instruction has finished.
+   assign Halt = (arm.ValidW & (arm.InstrW == 32'hEAFFFFFE)) |
+                 (MemWrite & MStrobe & PCReady & (DataAdr == HaltAdr));
+
+   // the pipeline moves only when both sides of memory are ready.
+   //   Flush (from the testbench, after a halt) stops it and writes
+   //   the data cache back; Flushed says dmem is up to date.
+   assign PCReady = IReady & DReady & ~Flush;
+
+   // instantiate processor, caches and memories
+   arm #(BTBEntries, RASDepth)
+       arm (.clk(clk),
             .reset(reset),
             .PCF(PC),
             .InstrF(Instr),
@@ -24,14 +60,50 @@ module top (input  logic        clk, reset,
             .MemStrobe(MStrobe),
             .PCReady(PCReady));
 
-   imem imem (.mem_addr(PC),
-              .mem_out(Instr));
-   dmem dmem (.mem_out(ReadData),
-              .r_w(MemWrite),
+   icache #(ICacheSets, ICacheWays, ICacheLineWords)
+          icache (.clk(clk),
+                  .reset(reset),
+                  .PCF(PC),
+                  .InstrF(Instr),
+                  .Ready(IReady),
+                  .CoreReady(PCReady),
+                  .MemAdr(IMemAdr),
+                  .MemReq(IMemReq),
+                  .MemData(IMemData),
+                  .MemReady(IMemReady));
+
+   imem #(.Timing(IMemTiming), .Latency(IMemLatency))
+        imem (.mem_addr(IMemAdr),
+              .mem_out(IMemData),
+              .clk(clk),
+              .req(IMemReq),
+              .ready(IMemReady));
+   dcache #(DCacheSets, DCacheWays, DCacheLineWords, WBEntries)
+          dcache (.clk(clk),
+                  .reset(reset),
+                  .Adr(DataAdr),
+                  .WriteData(WriteData),
+                  .MemWrite(MemWrite),
+                  .MemStrobe(MStrobe),
+                  .ReadData(ReadData),
+                  .Ready(DReady),
+                  .CoreReady(PCReady),
+                  .Flush(Flush),
+                  .Flushed(Flushed),
+                  .MemAdr(DMemAdr),
+                  .MemWriteData(DMemWriteData),
+                  .MemWriteEn(DMemWrite),
+                  .MemReq(DMemReq),
+                  .MemReadData(DMemReadData),
+                  .MemReady(DMemReady));
+
+   dmem #(.Timing(DMemTiming), .Latency(DMemLatency))
+        dmem (.mem_out(DMemReadData),
+              .r_w(DMemWrite),
               .clk(clk),
-              .mem_addr(DataAdr),
-              .mem_data(WriteData),
-              .MStrobe(MStrobe),
-              .PCReady(PCReady));
+              .mem_addr(DMemAdr),
+              .mem_data(DMemWriteData),
+              .MStrobe(DMemReq),
+              .PCReady(DMemReady));
    
 endmodule // top